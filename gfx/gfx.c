@@ -9,10 +9,19 @@
 #include "font.h"
 #include "gfxfont.h"
 #include "hardware/dma.h"
+#if defined(USE_RENDER_QUEUE) || defined(USE_PARALLEL_BANDS)
+#include "hardware/sync.h"
+#include "pico/multicore.h"
+#endif
 
 // Declare methods from the display drivers
 extern void LCD_WritePixel(int x, int y, struct Color col);
 extern void LCD_WriteBitmap(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *bitmap);
+extern void LCD_WriteBitmapAsync(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *bitmap);
+extern void LCD_waitForWrite();
+extern void LCD_FillRect(uint16_t x, uint16_t y, uint16_t w, uint16_t h, struct Color col);
+extern void LCD_beginWrite();
+extern void LCD_endWrite();
 extern uint16_t _width;	 ///< Display width as modified by current rotation
 extern uint16_t _height; ///< Display height as modified by current rotation
 
@@ -41,420 +50,1443 @@ bool isNotEqual(struct Color c1, struct Color c2)
 static int memcpy_dma_chan;
 static bool gfx_dma_init = false;
 
-uint16_t frameBufferX = 0;
-uint16_t frameBufferY = 0;
-uint16_t frameBufferWidth = 0;
-uint16_t frameBufferHeight = 0;
+// Where drawing goes. Each core has its own, so both can draw bands of a frame
+// at the same time.
+struct RenderTarget
+{
+	uint8_t *buffer; ///< Framebuffer, or NULL to draw to the display
+	uint16_t x;
+	uint16_t y;
+	uint16_t width;
+	uint16_t height;
+	bool clip;		///< Nothing is drawn outside of the framebuffer, used when drawing bands
+	uint8_t format; ///< enum GFX_PixelFormat of buffer
+};
+
+static struct RenderTarget renderTarget[2];
+#if defined(USE_RENDER_QUEUE) || defined(USE_PARALLEL_BANDS)
+#define fb (renderTarget[get_core_num()])
+#else
+#define fb (renderTarget[0])
+#endif
 
-uint8_t *gfxFramebuffer = NULL;
+// Drawing is limited to this area, see GFX_setClip. The ends are exclusive.
+static int16_t clipX0 = 0, clipY0 = 0;
+static int16_t clipX1 = INT16_MAX, clipY1 = INT16_MAX;
 
-static int16_t cursor_y = 0;
-int16_t cursor_x = 0;
-struct Color textcolor = GFX_WHITE;
-struct Color textbgcolor = GFX_BLACK;
-struct Color clearColour = GFX_BLACK;
-uint8_t wrap = 1;
+// Groups what a primitive sends into one display transaction. Bands being drawn
+// never reach the display, and the other core may be using it meanwhile.
+static inline void beginDraw()
+{
+	if (!fb.clip)
+		LCD_beginWrite();
+}
 
-GFXfont *gfxFont = NULL;
+static inline void endDraw()
+{
+	if (!fb.clip)
+		LCD_endWrite();
+}
 
-wchar_t wideCharacters[128] = {};
-uint8_t extraCharacters = 0;
+static inline uint32_t hashStep(uint32_t h, uint32_t v)
+{
+	return (h ^ v) * 16777619u;
+}
 
-char getCharForWideChar(wchar_t wc)
+#ifdef USE_TILE_HASH
+#define TILE_COLUMNS ((480 + TILE_SIZE - 1) / TILE_SIZE) ///< Tiles along the long side, in either rotation
+
+// Hash of what was last sent to each tile of the screen, in logical coordinates
+static uint32_t tileHash[TILE_COLUMNS * TILE_COLUMNS];
+static uint8_t tileKnown[(TILE_COLUMNS * TILE_COLUMNS + 7) / 8];
+static uint32_t tileScreenKey = 0; ///< tileKey() when the hashes were taken
+
+// What the hashes are only valid for: the same size, rotation and colour mode
+static uint32_t tileKey()
 {
-	for (uint8_t i = 0; i < 128; i++)
+	return _width | (uint32_t)LCD_getRotation() << 16 | (uint32_t)LCD_getColorMode() << 24;
+}
+
+// The tiles of an area no longer hold what was last hashed for them
+static void forgetTiles(int16_t x, int16_t y, int16_t w, int16_t h)
+{
+	int16_t x1 = x + w > (int16_t)_width ? _width : x + w;
+	int16_t y1 = y + h > (int16_t)_height ? _height : y + h;
+	for (int16_t ty = y < 0 ? 0 : y / TILE_SIZE; ty * TILE_SIZE < y1; ty++)
 	{
-		if (wc == wideCharacters[i])
+		for (int16_t tx = x < 0 ? 0 : x / TILE_SIZE; tx * TILE_SIZE < x1; tx++)
 		{
-			return i + 128;
+			uint16_t i = ty * TILE_COLUMNS + tx;
+			tileKnown[i / 8] &= ~(1 << (i % 8));
 		}
 	}
-	return '?';
 }
 
-typedef enum
+// FNV-1a over a part of a tile, with its position so parts of different size don't match
+static uint32_t hashTilePart(const uint8_t *p, uint32_t stride, uint16_t x, uint16_t y, uint16_t w, uint16_t h)
 {
-    DIACRITIC_NONE = 0,
-    DIACRITIC_ACUTE,  		// ´
-    DIACRITIC_CARON,  		// ˇ
-    DIACRITIC_DOT,    		// .
-} DIACRITIC;
+	uint32_t hash = hashStep(hashStep(2166136261u, x | (uint32_t)y << 16), w | (uint32_t)h << 16);
+	for (uint16_t row = 0; row < h; row++, p += stride)
+	{
+		uint16_t i = 0;
+		for (; i + 4 <= w * 3; i += 4)
+		{
+			uint32_t v;
+			memcpy(&v, p + i, 4);
+			hash = hashStep(hash, v);
+		}
+		for (; i < w * 3; i++)
+			hash = hashStep(hash, p[i]);
+	}
+	return hash;
+}
 
-void addExtraCharacter(wchar_t c)
+// Sends the rows of the columns x0..x1 of a bitmap, in one go when they are whole rows
+static void sendTileRun(uint16_t x, uint16_t y, uint16_t w, uint8_t *bitmap, uint16_t x0, uint16_t x1, uint16_t y0,
+						uint16_t y1)
 {
-	if(extraCharacters < 128)
+	if (x0 == x && x1 == x + w)
 	{
-		wideCharacters[extraCharacters] = c;
-		extraCharacters++;
-	} 
+		LCD_WriteBitmapAsync(x, y0, w, y1 - y0, bitmap + (y0 - y) * w * 3);
+		return;
+	}
+	// Each row continues the memory write of the one above
+	for (uint16_t row = y0; row < y1; row++)
+		LCD_WriteBitmapAsync(x0, row, x1 - x0, 1, bitmap + ((row - y) * w + x0 - x) * 3);
 }
+#endif
 
-uint GFX_getWidth()
+// Starts sending a bitmap like LCD_WriteBitmapAsync. With USE_TILE_HASH, the
+// tiles whose content was already sent are left out. When this returns, what
+// earlier calls sent is done.
+static void sendBitmap(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *bitmap)
 {
-	return _width;
+#ifdef USE_TILE_HASH
+	// Nothing may be sent below, but the caller may reuse the previous bitmap
+	LCD_waitForWrite();
+	if (tileScreenKey != tileKey())
+	{
+		memset(tileKnown, 0, sizeof(tileKnown));
+		tileScreenKey = tileKey();
+	}
+	// One transaction, so the parts go out as one memory write where they can
+	LCD_beginWrite();
+	for (uint16_t ty = y / TILE_SIZE * TILE_SIZE; ty < y + h; ty += TILE_SIZE)
+	{
+		uint16_t y0 = ty > y ? ty : y;
+		uint16_t y1 = ty + TILE_SIZE < y + h ? ty + TILE_SIZE : y + h;
+		int16_t runStart = -1; ///< First column of the changed tiles next to each other
+		uint16_t tx = x / TILE_SIZE * TILE_SIZE;
+		for (;; tx += TILE_SIZE)
+		{
+			uint16_t x0 = tx > x ? tx : x;
+			bool changed = false;
+			if (tx < x + w)
+			{
+				uint16_t x1 = tx + TILE_SIZE < x + w ? tx + TILE_SIZE : x + w;
+				uint32_t hash = hashTilePart(bitmap + ((y0 - y) * w + x0 - x) * 3, w * 3, x0 - tx, y0 - ty, x1 - x0, y1 - y0);
+				uint16_t i = ty / TILE_SIZE * TILE_COLUMNS + tx / TILE_SIZE;
+				changed = !(tileKnown[i / 8] & (1 << (i % 8))) || tileHash[i] != hash;
+				tileHash[i] = hash;
+				tileKnown[i / 8] |= 1 << (i % 8);
+			}
+			if (changed && runStart < 0)
+				runStart = x0;
+			if (!changed && runStart >= 0)
+			{
+				sendTileRun(x, y, w, bitmap, runStart, x0 < x + w ? x0 : x + w, y0, y1);
+				runStart = -1;
+			}
+			if (tx >= x + w)
+				break;
+		}
+	}
+	LCD_endWrite();
+#else
+	LCD_WriteBitmapAsync(x, y, w, h, bitmap);
+#endif
 }
 
-uint GFX_getHeight()
+// Direct drawing to the display, which may change tiles that were hashed
+static inline void screenPixel(int x, int y, struct Color color)
 {
-	return _height;
+#ifdef USE_TILE_HASH
+	forgetTiles(x, y, 1, 1);
+#endif
+	LCD_WritePixel(x, y, color);
 }
 
-void GFX_setClearColor(struct Color color)
+static inline void screenFill(int16_t x, int16_t y, int16_t w, int16_t h, struct Color color)
 {
-	clearColour = color;
+#ifdef USE_TILE_HASH
+	forgetTiles(x, y, w, h);
+#endif
+	LCD_FillRect(x, y, w, h, color);
 }
 
-void GFX_clearScreen()
+static uint8_t framebufFormat = GFX_FORMAT_RGB666; ///< Format of the framebuffers created next
+
+static uint32_t framebufBytes(uint8_t format, uint16_t w, uint16_t h)
 {
-	GFX_fillRect(0, 0, _width, _height, clearColour);
+	switch (format)
+	{
+	case GFX_FORMAT_INDEXED8:
+		return (uint32_t)w * h;
+	case GFX_FORMAT_RGB565:
+		return (uint32_t)w * h * 2;
+	case GFX_FORMAT_RGB111:
+		return ((uint32_t)w * h + 1) / 2;
+	default:
+		return (uint32_t)w * h * 3;
+	}
 }
 
-void GFX_fillScreen(struct Color color)
+// Most bytes a framebuffer of a format may take
+static uint32_t framebufLimit(uint8_t format)
 {
-	GFX_fillRect(0, 0, _width, _height, color);
+	return format == GFX_FORMAT_INDEXED8 ? INDEXED_BUFFER_MAX_SIZE : BUFFER_MAX_SIZE;
 }
 
-void GFX_drawPixel(int16_t x, int16_t y, struct Color color)
+// Whether count framebuffers of w x h may be created in a format. Formats
+// other than RGB666 are converted a row at a time when flushed, so a row has
+// to fit into a line buffer.
+static bool framebufAllowed(uint8_t format, uint16_t w, uint16_t h, uint8_t count)
+{
+	if (w == 0 || h == 0 || framebufBytes(format, w, h) * count > framebufLimit(format))
+		return false;
+	return format == GFX_FORMAT_RGB666 || (uint32_t)w * 3 <= FLUSH_LINE_SIZE;
+}
+
+#ifdef USE_INDEXED_FRAMEBUF
+static struct Color palette[256];
+static bool paletteSet = false; ///< Filled with the default RGB332 palette
+static struct Color lastIndexedColor;
+static int16_t lastIndex = -1; ///< Palette entry of lastIndexedColor, -1 when not known
+
+static void initPalette()
+{
+	for (uint16_t i = 0; i < 256; i++)
+		palette[i] = (struct Color){(i >> 5) * 255 / 7, ((i >> 2) & 7) * 255 / 7, (i & 3) * 255 / 3};
+	paletteSet = true;
+}
+
+// Closest palette entry, primitives draw in one colour so the last one is kept
+static uint8_t colorIndex(struct Color color)
 {
-	if (gfxFramebuffer != NULL)
+	if (lastIndex >= 0 && isEqual(color, lastIndexedColor))
+		return lastIndex;
+	if (!paletteSet)
+		initPalette();
+	uint32_t best = UINT32_MAX;
+	for (uint16_t i = 0; i < 256 && best; i++)
 	{
-		if ((x < frameBufferX) || (y < frameBufferY) || (x >= frameBufferX + frameBufferWidth) || (y >= frameBufferY + frameBufferHeight))
-		{
-			LCD_WritePixel(x, y, color);
-		}
-		else
+		int32_t dr = color.r - palette[i].r;
+		int32_t dg = color.g - palette[i].g;
+		int32_t db = color.b - palette[i].b;
+		uint32_t d = dr * dr + dg * dg + db * db;
+		if (d < best)
 		{
-			uint16_t relativeX = x - frameBufferX;
-			uint16_t relativeY = y - frameBufferY;
-			gfxFramebuffer[(relativeX + relativeY * frameBufferWidth) * 3] = color.r;
-			gfxFramebuffer[(relativeX + relativeY * frameBufferWidth) * 3 + 1] = color.g;
-			gfxFramebuffer[(relativeX + relativeY * frameBufferWidth) * 3 + 2] = color.b;
+			best = d;
+			lastIndex = i;
 		}
 	}
-	else
-	{
-		LCD_WritePixel(x, y, color);
-	}
-		
+	lastIndexedColor = color;
+	return lastIndex;
 }
 
-void GFX_drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, struct Color color)
+
+static void expandIndexed(uint8_t *dst, const uint8_t *src, uint32_t pixels)
 {
-	int16_t steep = abs(y1 - y0) > abs(x1 - x0);
-	if (steep)
+	for (uint32_t i = 0; i < pixels; i++)
 	{
-		swap(x0, y0);
-		swap(x1, y1);
+		const struct Color *c = &palette[src[i]];
+		*dst++ = c->r;
+		*dst++ = c->g;
+		*dst++ = c->b;
 	}
+}
+#endif
 
-	if (x0 > x1)
+#ifdef USE_RGB565_FRAMEBUF
+static inline uint16_t color565(struct Color color)
+{
+	return (color.r >> 3) << 11 | (color.g >> 2) << 5 | color.b >> 3;
+}
+
+// Two RGB565 pixels, the first one in the low half of v, to six RGB666 bytes.
+// Both halves are converted at once, the low bits repeat the high ones so
+// white stays white.
+static inline uint8_t *expand565Pair(uint8_t *dst, uint32_t v)
+{
+	uint32_t r = (v >> 11) & 0x001F001F;
+	uint32_t g = (v >> 5) & 0x003F003F;
+	uint32_t b = v & 0x001F001F;
+	r = r << 3 | r >> 2;
+	g = g << 2 | g >> 4;
+	b = b << 3 | b >> 2;
+	dst[0] = r;
+	dst[1] = g;
+	dst[2] = b;
+	dst[3] = r >> 16;
+	dst[4] = g >> 16;
+	dst[5] = b >> 16;
+	return dst + 6;
+}
+
+static inline uint8_t *expand565One(uint8_t *dst, uint16_t v)
+{
+	uint8_t r = v >> 11;
+	uint8_t g = (v >> 5) & 0x3F;
+	uint8_t b = v & 0x1F;
+	dst[0] = r << 3 | r >> 2;
+	dst[1] = g << 2 | g >> 4;
+	dst[2] = b << 3 | b >> 2;
+	return dst + 3;
+}
+
+static void expand565(uint8_t *dst, const uint16_t *src, uint32_t pixels)
+{
+	if (pixels > 0 && ((uintptr_t)src & 2))
 	{
-		swap(x0, x1);
-		swap(y0, y1);
+		// Get to a word boundary
+		dst = expand565One(dst, *src++);
+		pixels--;
 	}
+	const uint32_t *words = (const uint32_t *)src;
+	for (; pixels >= 2; pixels -= 2)
+		dst = expand565Pair(dst, *words++);
+	if (pixels)
+		expand565One(dst, *(const uint16_t *)words);
+}
+#endif
 
-	int16_t dx, dy;
-	dx = x1 - x0;
-	dy = abs(y1 - y0);
+#ifdef USE_RGB111_FRAMEBUF
+// Pixel i of a 3-bit framebuffer is in byte i / 2, bits 5-3 for even i and
+// bits 2-0 for odd i, the way the display takes them in 3-bit mode
+static inline void putPixel3(uint8_t *buffer, uint32_t i, uint8_t bits)
+{
+	uint8_t *p = &buffer[i / 2];
+	*p = i & 1 ? (*p & 0x38) | bits : (*p & 0x07) | bits << 3;
+}
 
-	int16_t err = dx / 2;
-	int16_t ystep;
+static inline uint8_t getPixel3(const uint8_t *buffer, uint32_t i)
+{
+	return (i & 1 ? buffer[i / 2] : buffer[i / 2] >> 3) & 7;
+}
 
-	if (y0 < y1)
+static void fillPixels3(uint8_t *buffer, uint32_t i, uint32_t n, uint8_t bits)
+{
+	if (n > 0 && (i & 1))
 	{
-		ystep = 1;
+		putPixel3(buffer, i++, bits);
+		n--;
 	}
-	else
+	// Whole bytes in between
+	memset(&buffer[i / 2], bits * 9, n / 2);
+	if (n & 1)
+		putPixel3(buffer, i + n - 1, bits);
+}
+
+static void expand3(uint8_t *dst, const uint8_t *buffer, uint32_t first, uint32_t pixels)
+{
+	for (uint32_t i = first; i < first + pixels; i++)
 	{
-		ystep = -1;
+		uint8_t bits = getPixel3(buffer, i);
+		*dst++ = bits & 4 ? 0xFF : 0;
+		*dst++ = bits & 2 ? 0xFF : 0;
+		*dst++ = bits & 1 ? 0xFF : 0;
 	}
+}
+#endif
 
-	for (; x0 <= x1; x0++)
+// Pixels converted or expanded on their way to the display, in two buffers so
+// one can be filled while the other is sent
+#if FLUSH_LINE_SIZE < 480 * 3
+#error FLUSH_LINE_SIZE has to hold a row of the screen
+#endif
+static uint8_t lineBuffers[2][FLUSH_LINE_SIZE] __attribute__((aligned(4)));
+
+#if defined(USE_INDEXED_FRAMEBUF) || defined(USE_RGB565_FRAMEBUF) || defined(USE_RGB111_FRAMEBUF)
+
+// Sends a framebuffer that isn't kept as RGB666. Rows are converted into two
+// line buffers in turn, one is filled while the other one is sent.
+static void flushConverted(const struct RenderTarget *t)
+{
+	uint8_t(*lines)[FLUSH_LINE_SIZE] = lineBuffers;
+#ifdef USE_TILE_HASH
+	forgetTiles(t->x, t->y, t->width, t->height);
+#endif
+	uint16_t rows = FLUSH_LINE_SIZE / (t->width * 3);
+	uint8_t next = 0;
+	LCD_beginWrite();
+	for (uint16_t y = 0; y < t->height; y += rows)
 	{
-		if (steep)
-		{
-			GFX_drawPixel(y0, x0, color);
-		}
-		else
-		{
-			GFX_drawPixel(x0, y0, color);
-		}
-		err -= dy;
-		if (err < 0)
+		uint16_t n = t->height - y < rows ? t->height - y : rows;
+		// The transfer from this line buffer two chunks back is done, starting
+		// the one in between waited for it
+		uint8_t *line = lines[next];
+		next ^= 1;
+		uint32_t first = (uint32_t)y * t->width;
+		switch (t->format)
 		{
-			y0 += ystep;
-			err += dx;
+#ifdef USE_INDEXED_FRAMEBUF
+		case GFX_FORMAT_INDEXED8:
+			if (!paletteSet)
+				initPalette();
+			expandIndexed(line, &t->buffer[first], (uint32_t)n * t->width);
+			break;
+#endif
+#ifdef USE_RGB565_FRAMEBUF
+		case GFX_FORMAT_RGB565:
+			expand565(line, (const uint16_t *)t->buffer + first, (uint32_t)n * t->width);
+			break;
+#endif
+#ifdef USE_RGB111_FRAMEBUF
+		case GFX_FORMAT_RGB111:
+			expand3(line, t->buffer, first, (uint32_t)n * t->width);
+			break;
+#endif
 		}
+		// Rows below each other continue the same memory write
+		LCD_WriteBitmapAsync(t->x, t->y + y, t->width, n, line);
 	}
+	LCD_waitForWrite();
+	LCD_endWrite();
 }
+#endif
 
-void GFX_drawFastVLine(int16_t x, int16_t y, int16_t h, struct Color color)
+static uint8_t *backFramebuffer = NULL; ///< Other half of a double framebuffer, may still be being sent
+
+static uint32_t framebufInUse = 0;	   ///< Framebuffer bytes currently handed out
+static uint32_t framebufHighWater = 0; ///< Most framebuffer bytes ever handed out at once
+
+#ifdef USE_FRAMEBUFFER_ARENA
+// The buffers in use are kept in address order and the free space is the
+// gaps between them. A released buffer merges with the gaps on both sides,
+// and a buffer goes into the first gap it fits, so buffers may be released
+// in any order without losing space.
+static uint8_t framebufArena[FRAMEBUFFER_ARENA_SIZE] __attribute__((aligned(4)));
+static uint32_t arenaStart[FRAMEBUFFER_ARENA_BLOCKS]; ///< Start of each buffer in use, ascending
+static uint32_t arenaEnd[FRAMEBUFFER_ARENA_BLOCKS];	  ///< End of each buffer in use
+static uint8_t arenaBlocks = 0;
+
+// First byte above the highest buffer in use
+static uint32_t arenaTop()
 {
-	GFX_drawLine(x, y, x, y + h - 1, color);
+	return arenaBlocks ? arenaEnd[arenaBlocks - 1] : 0;
 }
+#endif
 
-void GFX_drawFastHLine(int16_t x, int16_t y, int16_t l, struct Color color)
+// Takes size bytes for a framebuffer, NULL when there is no room
+static uint8_t *framebufAcquire(uint32_t size)
 {
-	GFX_drawLine(x, y, x + l - 1, y, color);
+	uint8_t *p;
+#ifdef USE_FRAMEBUFFER_ARENA
+	if (arenaBlocks == FRAMEBUFFER_ARENA_BLOCKS)
+		return NULL;
+	uint8_t i = 0;
+	uint32_t start = 0;
+	for (; i < arenaBlocks && start + size > arenaStart[i]; i++)
+		start = (arenaEnd[i] + 3) & ~3u;
+	if (start + size > FRAMEBUFFER_ARENA_SIZE)
+		return NULL;
+	memmove(&arenaStart[i + 1], &arenaStart[i], (arenaBlocks - i) * sizeof(arenaStart[0]));
+	memmove(&arenaEnd[i + 1], &arenaEnd[i], (arenaBlocks - i) * sizeof(arenaEnd[0]));
+	arenaStart[i] = start;
+	arenaEnd[i] = start + size;
+	arenaBlocks++;
+	p = &framebufArena[start];
+	if (arenaTop() > framebufHighWater)
+		framebufHighWater = arenaTop();
+#else
+	p = malloc(size);
+	if (p == NULL)
+		return NULL;
+	if (framebufInUse + size > framebufHighWater)
+		framebufHighWater = framebufInUse + size;
+#endif
+	framebufInUse += size;
+	LCD_STAT_ADD(framebufMallocs, 1);
+	return p;
 }
 
-static void GFX_fillRectFallback(int16_t x, int16_t y, int16_t w, int16_t h, struct Color color)
+static void framebufRelease(uint8_t *p, uint32_t size)
 {
-	for (int16_t i = x; i < x + w; i++)
+	if (p == NULL)
+		return;
+	framebufInUse -= size;
+	LCD_STAT_ADD(framebufFrees, 1);
+#ifdef USE_FRAMEBUFFER_ARENA
+	for (uint8_t i = 0; i < arenaBlocks; i++)
 	{
-		GFX_drawFastVLine(i, y, h, color);
+		if (&framebufArena[arenaStart[i]] == p)
+		{
+			arenaBlocks--;
+			memmove(&arenaStart[i], &arenaStart[i + 1], (arenaBlocks - i) * sizeof(arenaStart[0]));
+			memmove(&arenaEnd[i], &arenaEnd[i + 1], (arenaBlocks - i) * sizeof(arenaEnd[0]));
+			break;
+		}
 	}
+#else
+	free(p);
+#endif
 }
 
-static void GFX_fillActiveFramebuffer(struct Color color)
+
+static int16_t cursor_y = 0;
+int16_t cursor_x = 0;
+struct Color textcolor = GFX_WHITE;
+struct Color textbgcolor = GFX_BLACK;
+struct Color clearColour = GFX_BLACK;
+uint8_t wrap = 1;
+
+GFXfont *gfxFont = NULL;
+
+wchar_t wideCharacters[128] = {};
+uint8_t extraCharacters = 0;
+
+#if defined(USE_DISPLAY_LIST) || defined(USE_RENDER_QUEUE)
+enum GFX_Op
 {
-	const uint32_t pixels = (uint32_t)frameBufferWidth * (uint32_t)frameBufferHeight;
-	for (uint32_t i = 0; i < pixels; i++)
-	{
-		gfxFramebuffer[i * 3U] = color.r;
-		gfxFramebuffer[i * 3U + 1U] = color.g;
-		gfxFramebuffer[i * 3U + 2U] = color.b;
-	}
+	OP_PIXEL,
+	OP_LINE,
+	OP_VLINE,
+	OP_HLINE,
+	OP_RECT,
+	OP_FILL_RECT,
+	OP_FILL_ROUNDED_RECT,
+	OP_TRIANGLE,
+	OP_FILL_TRIANGLE,
+	OP_CIRCLE,
+	OP_FILL_CIRCLE,
+	OP_CHAR,
+	OP_BITMAP,
+	// Only posted to the render core, never recorded
+	OP_CLEAR_COLOR,
+	OP_CREATE_FRAMEBUF,
+	OP_CREATE_DOUBLE_FRAMEBUF,
+	OP_MOVE_FRAMEBUF,
+	OP_DESTROY_FRAMEBUF,
+	OP_SET_FORMAT,
+	OP_SET_PALETTE_COLOR,
+	OP_SCROLL_AREA,
+	OP_SCROLL_START,
+	OP_SET_CLIP,
+	OP_PARTIAL_ROWS,
+	OP_FLUSH,
+	OP_BEGIN_FRAME,
+	OP_END_FRAME,
+	OP_FLUSH_DIRTY,
+	OP_STOP_RENDER_CORE,
+};
+
+// One recorded or posted GFX_* call with its arguments and the area it can touch
+struct GFX_Command
+{
+	uint8_t op;
+	unsigned char c;
+	uint8_t size_x, size_y;
+	int16_t a[6]; ///< Coordinates, in the order the GFX_* call takes them
+	struct Color color;
+	struct Color bg;
+	const GFXfont *font;
+	const uint8_t *bitmap;	///< Of GFX_drawBitmapScaled, has to stay unchanged until drawn
+	int16_t x0, y0, x1, y1; ///< Bounding box, inclusive
+};
+
+static void replayCommand(const struct GFX_Command *cmd);
+#endif
+
+#ifdef USE_DISPLAY_LIST
+static struct GFX_Command displayList[DISPLAY_LIST_SIZE];
+static uint16_t displayListLength = 0;
+static bool recording = false;
+static bool displayListOverflow = false;
+
+static void renderDisplayList();
+
+static void setBounds(struct GFX_Command *cmd, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+	cmd->x0 = x0 < x1 ? x0 : x1;
+	cmd->x1 = x0 < x1 ? x1 : x0;
+	cmd->y0 = y0 < y1 ? y0 : y1;
+	cmd->y1 = y0 < y1 ? y1 : y0;
 }
 
-void GFX_fillRect(int16_t x, int16_t y, int16_t w, int16_t h, struct Color color)
+static void recordCommand(struct GFX_Command cmd)
 {
-	if (w <= 0 || h <= 0)
+	const int16_t *a = cmd.a;
+	switch (cmd.op)
 	{
-		return;
+	case OP_PIXEL:
+		setBounds(&cmd, a[0], a[1], a[0], a[1]);
+		break;
+	case OP_LINE:
+		setBounds(&cmd, a[0], a[1], a[2], a[3]);
+		break;
+	case OP_VLINE:
+		setBounds(&cmd, a[0], a[1], a[0], a[1] + a[2] - 1);
+		break;
+	case OP_HLINE:
+		setBounds(&cmd, a[0], a[1], a[0] + a[2] - 1, a[1]);
+		break;
+	case OP_RECT:
+	case OP_FILL_RECT:
+	case OP_FILL_ROUNDED_RECT:
+		setBounds(&cmd, a[0], a[1], a[0] + a[2] - 1, a[1] + a[3] - 1);
+		break;
+	case OP_TRIANGLE:
+	case OP_FILL_TRIANGLE:
+		setBounds(&cmd, a[0], a[1], a[2], a[3]);
+		setBounds(&cmd, cmd.x0 < a[4] ? cmd.x0 : a[4], cmd.y0 < a[5] ? cmd.y0 : a[5],
+				  cmd.x1 > a[4] ? cmd.x1 : a[4], cmd.y1 > a[5] ? cmd.y1 : a[5]);
+		break;
+	case OP_CIRCLE:
+	case OP_FILL_CIRCLE:
+		setBounds(&cmd, a[0] - a[2], a[1] - a[2], a[0] + a[2], a[1] + a[2]);
+		break;
+	case OP_BITMAP:
+		setBounds(&cmd, a[0], a[1], a[0] + a[2] * cmd.size_x - 1, a[1] + a[3] * cmd.size_y - 1);
+		break;
+	case OP_CHAR:
+		if (!cmd.font)
+		{
+			// Diacritics reach up to 4 rows above the cell
+			setBounds(&cmd, a[0], a[1] - 4 * cmd.size_y, a[0] + 6 * cmd.size_x - 1, a[1] + 8 * cmd.size_y - 1);
+		}
+		else if (cmd.c >= cmd.font->first && cmd.c <= cmd.font->last)
+		{
+			GFXglyph *glyph = cmd.font->glyph + (cmd.c - cmd.font->first);
+			setBounds(&cmd, a[0] + glyph->xOffset * cmd.size_x, a[1] + glyph->yOffset * cmd.size_y,
+					  a[0] + (glyph->xOffset + glyph->width) * cmd.size_x - 1,
+					  a[1] + (glyph->yOffset + glyph->height) * cmd.size_y - 1);
+		}
+		else
+		{
+			return;
+		}
+		break;
 	}
-
-	if (hasFrameBuffer())
+	if (cmd.x1 < 0 || cmd.y1 < 0 || cmd.x0 >= (int16_t)_width || cmd.y0 >= (int16_t)_height)
 	{
-		GFX_fillRectFallback(x, y, w, h, color);
 		return;
 	}
 
-	if (x < 0)
-	{
-		w += x;
-		x = 0;
-	}
-	if (y < 0)
-	{
-		h += y;
-		y = 0;
-	}
-	if (x >= (int16_t)_width || y >= (int16_t)_height)
+	if (displayListLength == DISPLAY_LIST_SIZE)
 	{
+		// Put what was recorded on the screen and draw the rest of the frame directly
+		displayListOverflow = true;
+		renderDisplayList();
+		replayCommand(&cmd);
 		return;
 	}
-	if (x + w > (int16_t)_width)
-	{
-		w = (int16_t)_width - x;
-	}
-	if (y + h > (int16_t)_height)
-	{
-		h = (int16_t)_height - y;
-	}
-	if (w <= 0 || h <= 0)
+	displayList[displayListLength++] = cmd;
+}
+
+#ifdef USE_DIRTY_RECTS
+#define DIRTY_LOOKAHEAD 8 ///< Calls the frame comparison skips to find the two frames in step again
+
+// What is kept of each call of the last frame drawn
+struct FrameEntry
+{
+	uint32_t hash;
+	int16_t x0, y0, x1, y1;
+};
+
+struct DirtyRect
+{
+	int16_t x0, y0, x1, y1; ///< Inclusive
+};
+
+static struct FrameEntry lastFrame[DISPLAY_LIST_SIZE];
+static uint16_t lastFrameLength = 0;
+static bool lastFrameShown = false; ///< The screen shows exactly the last frame
+static uint16_t lastFrameWidth, lastFrameHeight;
+static uint8_t lastFrameRotation;
+static enum LCD_ColorMode lastFrameColorMode;
+static struct Color lastFrameClear;
+static int16_t lastFrameClip[4]; ///< Only this area of the screen shows the last frame
+static struct DirtyRect dirtyRects[DIRTY_RECT_COUNT];
+static uint8_t dirtyCount = 0;
+
+// FNV-1a of the arguments, two calls with the same hash draw the same pixels
+static uint32_t commandHash(const struct GFX_Command *cmd)
+{
+	uint32_t h = 2166136261u;
+	h = hashStep(h, cmd->op | cmd->c << 8 | cmd->size_x << 16 | (uint32_t)cmd->size_y << 24);
+	for (uint8_t i = 0; i < 6; i++)
+		h = hashStep(h, (uint16_t)cmd->a[i]);
+	h = hashStep(h, cmd->color.r | cmd->color.g << 8 | cmd->color.b << 16);
+	h = hashStep(h, cmd->bg.r | cmd->bg.g << 8 | cmd->bg.b << 16);
+	if (cmd->op == OP_BITMAP)
 	{
-		return;
+		// The same bitmap may hold another picture by the next frame
+		for (uint32_t i = 0; i < (uint32_t)(cmd->a[2] + 7) / 8 * cmd->a[3]; i++)
+			h = hashStep(h, cmd->bitmap[i]);
 	}
+	return hashStep(h, (uint32_t)(uintptr_t)cmd->font);
+}
 
-	const uint32_t maxPixelsPerChunk = (uint32_t)BUFFER_MAX_SIZE / 3U;
-	if (maxPixelsPerChunk == 0U)
+static void rememberFrame()
+{
+	for (uint16_t i = 0; i < displayListLength; i++)
 	{
-		GFX_fillRectFallback(x, y, w, h, color);
-		return;
+		const struct GFX_Command *cmd = &displayList[i];
+		lastFrame[i] = (struct FrameEntry){commandHash(cmd), cmd->x0, cmd->y0, cmd->x1, cmd->y1};
 	}
+	lastFrameLength = displayListLength;
+	lastFrameShown = true;
+	lastFrameWidth = _width;
+	lastFrameHeight = _height;
+	lastFrameRotation = LCD_getRotation();
+	lastFrameColorMode = LCD_getColorMode();
+	lastFrameClear = clearColour;
+	lastFrameClip[0] = clipX0;
+	lastFrameClip[1] = clipY0;
+	lastFrameClip[2] = clipX1;
+	lastFrameClip[3] = clipY1;
+}
 
-	const uint16_t maxChunkWidth = (uint16_t)((w < (int16_t)maxPixelsPerChunk) ? w : (int16_t)maxPixelsPerChunk);
-	for (uint16_t xOffset = 0; xOffset < (uint16_t)w; xOffset += maxChunkWidth)
-	{
-		const uint16_t chunkW = (uint16_t)(((uint16_t)w - xOffset < maxChunkWidth) ? ((uint16_t)w - xOffset) : maxChunkWidth);
-		const uint16_t maxChunkHeight = (uint16_t)(maxPixelsPerChunk / chunkW);
-		const uint16_t chunkStepH = (maxChunkHeight == 0U) ? 1U : maxChunkHeight;
+static int32_t rectArea(struct DirtyRect r)
+{
+	return (int32_t)(r.x1 - r.x0 + 1) * (r.y1 - r.y0 + 1);
+}
 
-		for (uint16_t yOffset = 0; yOffset < (uint16_t)h; yOffset += chunkStepH)
-		{
-			const uint16_t chunkH = (uint16_t)(((uint16_t)h - yOffset < chunkStepH) ? ((uint16_t)h - yOffset) : chunkStepH);
+static struct DirtyRect rectUnion(struct DirtyRect a, struct DirtyRect b)
+{
+	return (struct DirtyRect){a.x0 < b.x0 ? a.x0 : b.x0, a.y0 < b.y0 ? a.y0 : b.y0, a.x1 > b.x1 ? a.x1 : b.x1,
+							  a.y1 > b.y1 ? a.y1 : b.y1};
+}
+
+// Pixels a merge adds that neither rectangle covers, negative when they overlap
+static int32_t mergeWaste(struct DirtyRect a, struct DirtyRect b)
+{
+	return rectArea(rectUnion(a, b)) - rectArea(a) - rectArea(b);
+}
+
+static bool rectsOverlap(struct DirtyRect a, struct DirtyRect b)
+{
+	return a.x0 <= b.x1 && b.x0 <= a.x1 && a.y0 <= b.y1 && b.y0 <= a.y1;
+}
 
-			GFX_createFramebuf((uint16_t)x + xOffset, (uint16_t)y + yOffset, chunkW, chunkH);
-			if (!hasFrameBuffer())
+// Adds an area to the dirty set. It is merged with the areas it overlaps or
+// is close enough to, and with the cheapest one when the set is full.
+static void addDirty(int16_t x0, int16_t y0, int16_t x1, int16_t y1)
+{
+	struct DirtyRect r = {x0 < 0 ? 0 : x0, y0 < 0 ? 0 : y0, x1 >= (int16_t)_width ? _width - 1 : x1,
+						  y1 >= (int16_t)_height ? _height - 1 : y1};
+	if (r.x0 > r.x1 || r.y0 > r.y1)
+		return;
+	for (;;)
+	{
+		int8_t merge = -1;
+		for (uint8_t i = 0; i < dirtyCount && merge < 0; i++)
+		{
+			if (rectsOverlap(r, dirtyRects[i]) || mergeWaste(r, dirtyRects[i]) <= DIRTY_RECT_WASTE)
+				merge = i;
+		}
+		if (merge < 0 && dirtyCount == DIRTY_RECT_COUNT)
+		{
+			merge = 0;
+			for (uint8_t i = 1; i < dirtyCount; i++)
 			{
-				GFX_fillRectFallback((int16_t)((uint16_t)x + xOffset), (int16_t)((uint16_t)y + yOffset), (int16_t)chunkW, (int16_t)chunkH, color);
-				continue;
+				if (mergeWaste(r, dirtyRects[i]) < mergeWaste(r, dirtyRects[merge]))
+					merge = i;
 			}
-
-			GFX_fillActiveFramebuffer(color);
-			GFX_flush();
-			GFX_destroyFramebuf();
 		}
+		if (merge < 0)
+			break;
+		// The grown area may now reach others, so look again
+		r = rectUnion(r, dirtyRects[merge]);
+		dirtyRects[merge] = dirtyRects[--dirtyCount];
 	}
+	dirtyRects[dirtyCount++] = r;
 }
 
-void fillCircleHelper(int16_t x0, int16_t y0, int16_t r,
-					  uint8_t corners, int16_t delta,
-					  struct Color color)
+// Marks the areas of the calls that differ between the last frame and this
+// one. The calls found in both keep their order, so wherever the two frames
+// can differ one of the unmatched calls draws.
+static void diffFrames()
 {
-
-	int16_t f = 1 - r;
-	int16_t ddF_x = 1;
-	int16_t ddF_y = -2 * r;
-	int16_t x = 0;
-	int16_t y = r;
-	int16_t px = x;
-	int16_t py = y;
-
-	delta++; // Avoid some +1's in the loop
-
-	while (x < y)
+	uint16_t i = 0; ///< In the last frame
+	uint16_t j = 0; ///< In this frame
+	while (i < lastFrameLength || j < displayListLength)
 	{
-		if (f >= 0)
+		if (i < lastFrameLength && j < displayListLength && lastFrame[i].hash == commandHash(&displayList[j]))
 		{
-			y--;
-			ddF_y += 2;
-			f += ddF_y;
+			i++;
+			j++;
+			continue;
 		}
-		x++;
-		ddF_x += 2;
-		f += ddF_x;
-		// These checks avoid double-drawing certain lines, important
-		// for the SSD1306 library which has an INVERT drawing mode.
-		if (x < (y + 1))
+		uint16_t inserted = 0;
+		uint16_t removed = 0;
+		for (uint16_t d = 1; d <= DIRTY_LOOKAHEAD && !inserted && !removed; d++)
 		{
-			if (corners & 1)
-				GFX_drawFastVLine(x0 + x, y0 - y, 2 * y + delta, color);
-			if (corners & 2)
-				GFX_drawFastVLine(x0 - x, y0 - y, 2 * y + delta, color);
+			if (i < lastFrameLength && j + d < displayListLength && lastFrame[i].hash == commandHash(&displayList[j + d]))
+				inserted = d;
+			else if (j < displayListLength && i + d < lastFrameLength &&
+					 lastFrame[i + d].hash == commandHash(&displayList[j]))
+				removed = d;
 		}
-		if (y != py)
+		if (!inserted && !removed)
 		{
-			if (corners & 1)
-				GFX_drawFastVLine(x0 + py, y0 - px, 2 * px + delta, color);
-			if (corners & 2)
-				GFX_drawFastVLine(x0 - py, y0 - px, 2 * px + delta, color);
-			py = y;
+			// Changed in place
+			inserted = j < displayListLength;
+			removed = i < lastFrameLength;
 		}
-		px = x;
+		for (; inserted > 0; inserted--, j++)
+			addDirty(displayList[j].x0, displayList[j].y0, displayList[j].x1, displayList[j].y1);
+		for (; removed > 0; removed--, i++)
+			addDirty(lastFrame[i].x0, lastFrame[i].y0, lastFrame[i].x1, lastFrame[i].y1);
 	}
 }
+#else
+#define rememberFrame()
+#endif
 
-void GFX_fillRoundedRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t r, struct Color color)
+#endif
+
+#ifdef USE_RENDER_QUEUE
+#define RENDER_CORE 1
+
+// Calls from the other core go through this single producer, single consumer
+// ring. Head and tail only ever grow, the producer writes head and the render
+// core tail, so neither needs a lock.
+static struct GFX_Command renderQueue[RENDER_QUEUE_SIZE];
+static volatile uint32_t queueHead = 0; ///< Commands posted
+static volatile uint32_t queueTail = 0; ///< Commands taken by the render core
+static volatile uint32_t queueDone = 0; ///< Commands drawn, see GFX_fence
+static volatile bool renderCoreRunning = false;
+
+static void postCommand(const struct GFX_Command *cmd)
 {
-	if (w <= 0 || h <= 0) return;
+	uint32_t head = queueHead;
+	while (head - queueTail == RENDER_QUEUE_SIZE)
+		tight_loop_contents(); // Full, wait for the render core to take one
+	renderQueue[head % RENDER_QUEUE_SIZE] = *cmd;
+	__mem_fence_release();
+	queueHead = head + 1;
+}
+#endif
 
-	if (r <= 0) {
-		GFX_fillRect(x, y, w, h, color);
-		return;
+#if defined(USE_DISPLAY_LIST) || defined(USE_RENDER_QUEUE)
+// Drawing calls from another core than the render core are posted to it, and
+// calls made between GFX_beginFrame and GFX_endFrame are recorded. Returns
+// true when the call was taken and must not be drawn now.
+static inline bool captureCommand(struct GFX_Command cmd, bool draws)
+{
+#ifdef USE_RENDER_QUEUE
+	if (renderCoreRunning && get_core_num() != RENDER_CORE)
+	{
+		postCommand(&cmd);
+		return true;
 	}
+#endif
+#ifdef USE_DISPLAY_LIST
+	if (draws && recording)
+	{
+		recordCommand(cmd);
+		return true;
+	}
+#endif
+#ifdef USE_DIRTY_RECTS
+	if (draws)
+		lastFrameShown = false; // Drawn outside of a frame, the next one is sent whole
+#endif
+	(void)cmd;
+	(void)draws;
+	return false;
+}
 
-	if (r > w / 2) r = w / 2;
-	if (r > h / 2) r = h / 2;
+// Draws the call only when it isn't recorded or posted to the render core
+#define GFX_RECORD(...)                                              \
+	if (captureCommand((struct GFX_Command){__VA_ARGS__}, true))     \
+	{                                                                \
+		return;                                                      \
+	}
+// Changes the state of the render core when called from the other core
+#define GFX_POST(...)                                                \
+	if (captureCommand((struct GFX_Command){__VA_ARGS__}, false))    \
+	{                                                                \
+		return;                                                      \
+	}
+#else
+#define GFX_RECORD(...)
+#define GFX_POST(...)
+#endif
 
-	// Fill the central rectangle (between rounded corners)
-	GFX_fillRect(x + r, y, w - 2 * r, h, color);
+#ifdef USE_RENDER_QUEUE
+// Whether the display may be touched from this core
+#define DRAWS_HERE() (!renderCoreRunning || get_core_num() == RENDER_CORE)
+#else
+#define DRAWS_HERE() true
+#endif
 
-	// Fill the rounded corners using helper (extends vertical spans by delta)
-	fillCircleHelper(x + w - r - 1, y + r, r, 1, h - 2 * r - 1, color); // Right corners
-	fillCircleHelper(x + r,           y + r, r, 2, h - 2 * r - 1, color); // Left corners
+char getCharForWideChar(wchar_t wc)
+{
+	for (uint8_t i = 0; i < 128; i++)
+	{
+		if (wc == wideCharacters[i])
+		{
+			return i + 128;
+		}
+	}
+	return '?';
 }
 
-void GFX_drawRect(int16_t x, int16_t y, int16_t w, int16_t h, struct Color color)
+typedef enum
 {
-	GFX_drawFastHLine(x, y, w, color);
-	GFX_drawFastHLine(x, y + h - 1, w, color);
-	GFX_drawFastVLine(x, y, h, color);
-	GFX_drawFastVLine(x + w - 1, y, h, color);
+    DIACRITIC_NONE = 0,
+    DIACRITIC_ACUTE,  		// ´
+    DIACRITIC_CARON,  		// ˇ
+    DIACRITIC_DOT,    		// .
+} DIACRITIC;
+
+void addExtraCharacter(wchar_t c)
+{
+	if(extraCharacters < 128)
+	{
+		wideCharacters[extraCharacters] = c;
+		extraCharacters++;
+	} 
 }
 
-void GFX_drawTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, struct Color color)
+uint GFX_getWidth()
 {
-	GFX_drawLine(x0, y0, x1, y1, color);
-	GFX_drawLine(x1, y1, x2, y2, color);
-	GFX_drawLine(x2, y2, x0, y0, color);
+	return _width;
 }
 
-void GFX_fillTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, struct Color color)
+uint GFX_getHeight()
 {
-	int16_t a;
-	int16_t b;
-	int16_t y;
-	int32_t sa = 0;
-	int32_t sb = 0;
+	return _height;
+}
 
-	if (y0 > y1)
+void GFX_setClip(int16_t x, int16_t y, int16_t w, int16_t h)
+{
+	GFX_POST(.op = OP_SET_CLIP, .a = {x, y, w, h});
+	clipX0 = x;
+	clipY0 = y;
+	clipX1 = (int32_t)x + w < INT16_MAX ? x + w : INT16_MAX;
+	clipY1 = (int32_t)y + h < INT16_MAX ? y + h : INT16_MAX;
+}
+
+void GFX_resetClip()
+{
+	GFX_setClip(0, 0, INT16_MAX, INT16_MAX);
+}
+
+// Memory rows start..end are shown, or all of them when start is negative
+static void setPartialRows(int16_t start, int16_t end)
+{
+	GFX_POST(.op = OP_PARTIAL_ROWS, .a = {start, end});
+	if (start < 0)
+		LCD_enterNormalMode();
+	else
+		LCD_enterPartialMode(start, end);
+}
+
+void GFX_enterPartialMode(int16_t x, int16_t y, int16_t w, int16_t h)
+{
+	GFX_setClip(x, y, w, h);
+	// Memory rows run along the screen's y in portrait and along its x in landscape,
+	// from the other side in rotations 2 and 3
+	uint8_t rotation = LCD_getRotation();
+	int16_t first = rotation & 1 ? x : y;
+	int16_t last = first + (rotation & 1 ? w : h) - 1;
+	first = first < 0 ? 0 : first;
+	last = last > ILI9488_TFTHEIGHT - 1 ? ILI9488_TFTHEIGHT - 1 : last;
+	if (first > last)
+		return;
+	if (rotation >= 2)
+		setPartialRows(ILI9488_TFTHEIGHT - 1 - last, ILI9488_TFTHEIGHT - 1 - first);
+	else
+		setPartialRows(first, last);
+}
+
+void GFX_exitPartialMode()
+{
+	setPartialRows(-1, -1);
+	GFX_resetClip();
+}
+
+void GFX_setClearColor(struct Color color)
+{
+	GFX_POST(.op = OP_CLEAR_COLOR, .color = color);
+	clearColour = color;
+}
+
+void GFX_clearScreen()
+{
+	GFX_fillRect(0, 0, _width, _height, clearColour);
+}
+
+void GFX_fillScreen(struct Color color)
+{
+	GFX_fillRect(0, 0, _width, _height, color);
+}
+
+void GFX_drawPixel(int16_t x, int16_t y, struct Color color)
+{
+	GFX_RECORD(.op = OP_PIXEL, .a = {x, y}, .color = color);
+	if (x < clipX0 || y < clipY0 || x >= clipX1 || y >= clipY1)
+		return;
+	struct RenderTarget *t = &fb;
+	if (t->buffer != NULL)
 	{
-		swap(y0, y1);
-		swap(x0, x1);
+		if ((x < t->x) || (y < t->y) || (x >= t->x + t->width) || (y >= t->y + t->height))
+		{
+			if (!t->clip)
+				screenPixel(x, y, color);
+		}
+		else
+		{
+			uint16_t relativeX = x - t->x;
+			uint16_t relativeY = y - t->y;
+#ifdef USE_INDEXED_FRAMEBUF
+			if (t->format == GFX_FORMAT_INDEXED8)
+			{
+				t->buffer[relativeX + relativeY * t->width] = colorIndex(color);
+				return;
+			}
+#endif
+#ifdef USE_RGB565_FRAMEBUF
+			if (t->format == GFX_FORMAT_RGB565)
+			{
+				((uint16_t *)t->buffer)[relativeX + relativeY * t->width] = color565(color);
+				return;
+			}
+#endif
+#ifdef USE_RGB111_FRAMEBUF
+			if (t->format == GFX_FORMAT_RGB111)
+			{
+				putPixel3(t->buffer, relativeX + relativeY * t->width, LCD_COLOR3(color));
+				return;
+			}
+#endif
+			t->buffer[(relativeX + relativeY * t->width) * 3] = color.r;
+			t->buffer[(relativeX + relativeY * t->width) * 3 + 1] = color.g;
+			t->buffer[(relativeX + relativeY * t->width) * 3 + 2] = color.b;
+		}
 	}
-	if (y1 > y2)
+	else
 	{
-		swap(y2, y1);
-		swap(x2, x1);
+		screenPixel(x, y, color);
 	}
-	if (y0 > y1)
+		
+}
+
+void GFX_drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, struct Color color)
+{
+	GFX_RECORD(.op = OP_LINE, .a = {x0, y0, x1, y1}, .color = color);
+	int16_t steep = abs(y1 - y0) > abs(x1 - x0);
+	if (steep)
+	{
+		swap(x0, y0);
+		swap(x1, y1);
+	}
+
+	if (x0 > x1)
 	{
-		swap(y0, y1);
 		swap(x0, x1);
+		swap(y0, y1);
 	}
 
-	if (y0 == y2)
+	int16_t dx, dy;
+	dx = x1 - x0;
+	dy = abs(y1 - y0);
+
+	beginDraw();
+
+	int16_t err = dx / 2;
+	int16_t ystep;
+
+	if (y0 < y1)
 	{
-		a = b = x0;
-		if (x1 < a)
-		{
-			a = x1;
-		}
-		else if (x1 > b)
+		ystep = 1;
+	}
+	else
+	{
+		ystep = -1;
+	}
+
+	for (; x0 <= x1; x0++)
+	{
+		if (steep)
 		{
-			b = x1;
+			GFX_drawPixel(y0, x0, color);
 		}
-		if (x2 < a)
+		else
 		{
-			a = x2;
+			GFX_drawPixel(x0, y0, color);
 		}
-		else if (x2 > b)
+		err -= dy;
+		if (err < 0)
 		{
-			b = x2;
+			y0 += ystep;
+			err += dx;
 		}
-		GFX_drawFastHLine(a, y0, b - a + 1, color);
-		return;
 	}
+	endDraw();
+}
 
-	int16_t dx01 = x1 - x0;
-	int16_t dy01 = y1 - y0;
-	int16_t dx02 = x2 - x0;
-	int16_t dy02 = y2 - y0;
-	int16_t dx12 = x2 - x1;
-	int16_t dy12 = y2 - y1;
+// Fills an area that is already clipped to the screen. The part covered by the
+// framebuffer is written there, the rest goes straight to the display, the
+// same way GFX_drawPixel treats single pixels.
+static void fillArea(int16_t x, int16_t y, int16_t w, int16_t h, struct Color color)
+{
+	if (x < clipX0)
+	{
+		w -= clipX0 - x;
+		x = clipX0;
+	}
+	if (y < clipY0)
+	{
+		h -= clipY0 - y;
+		y = clipY0;
+	}
+	if (x + w > clipX1)
+		w = clipX1 - x;
+	if (y + h > clipY1)
+		h = clipY1 - y;
+	if (w <= 0 || h <= 0)
+		return;
 
-	int16_t last;
-	if (y1 == y2)
+	struct RenderTarget *t = &fb;
+	if (t->buffer == NULL)
 	{
-		last = y1;
+		screenFill(x, y, w, h, color);
+		return;
 	}
-	else
+
+	int16_t ix0 = x > (int16_t)t->x ? x : (int16_t)t->x;
+	int16_t iy0 = y > (int16_t)t->y ? y : (int16_t)t->y;
+	int16_t ix1 = x + w < t->x + t->width ? x + w : t->x + t->width;
+	int16_t iy1 = y + h < t->y + t->height ? y + h : t->y + t->height;
+	if (ix0 >= ix1 || iy0 >= iy1)
 	{
-		last = y1 - 1;
+		if (!t->clip)
+			screenFill(x, y, w, h, color);
+		return;
 	}
 
-	for (y = y0; y <= last; y++)
+	if (!t->clip)
 	{
-		a = x0 + sa / dy01;
-		b = x0 + sb / dy02;
-		sa += dx01;
-		sb += dx02;
-		if (a > b)
-		{
-			swap(a, b);
-		}
-		GFX_drawFastHLine(a, y, b - a + 1, color);
+		if (y < iy0)
+			screenFill(x, y, w, iy0 - y, color);
+		if (iy1 < y + h)
+			screenFill(x, iy1, w, y + h - iy1, color);
+		if (x < ix0)
+			screenFill(x, iy0, ix0 - x, iy1 - iy0, color);
+		if (ix1 < x + w)
+			screenFill(ix1, iy0, x + w - ix1, iy1 - iy0, color);
 	}
 
-	sa = (int32_t)dx12 * (int32_t)(y - y1);
-	sb = (int32_t)dx02 * (int32_t)(y - y0);
-	for (; y <= y2; y++)
+#ifdef USE_INDEXED_FRAMEBUF
+	if (t->format == GFX_FORMAT_INDEXED8)
 	{
-		a = x1 + sa / dy12;
-		b = x0 + sb / dy02;
-		sa += dx12;
+		uint8_t index = colorIndex(color);
+		if (ix0 == t->x && ix1 == t->x + t->width)
+		{
+			// Whole rows are one run
+			memset(&t->buffer[(iy0 - t->y) * t->width], index, (iy1 - iy0) * t->width);
+			return;
+		}
+		for (int16_t row = iy0; row < iy1; row++)
+			memset(&t->buffer[(row - t->y) * t->width + (ix0 - t->x)], index, ix1 - ix0);
+		return;
+	}
+#endif
+#ifdef USE_RGB565_FRAMEBUF
+	if (t->format == GFX_FORMAT_RGB565)
+	{
+		uint16_t c = color565(color);
+		for (int16_t row = iy0; row < iy1; row++)
+		{
+			uint16_t *p = (uint16_t *)t->buffer + (row - t->y) * t->width + (ix0 - t->x);
+			for (int16_t i = ix0; i < ix1; i++)
+				*p++ = c;
+		}
+		return;
+	}
+#endif
+#ifdef USE_RGB111_FRAMEBUF
+	if (t->format == GFX_FORMAT_RGB111)
+	{
+		uint8_t bits = LCD_COLOR3(color);
+		if (ix0 == t->x && ix1 == t->x + t->width)
+		{
+			fillPixels3(t->buffer, (iy0 - t->y) * t->width, (iy1 - iy0) * t->width, bits);
+			return;
+		}
+		for (int16_t row = iy0; row < iy1; row++)
+			fillPixels3(t->buffer, (row - t->y) * t->width + (ix0 - t->x), ix1 - ix0, bits);
+		return;
+	}
+#endif
+
+	for (int16_t row = iy0; row < iy1; row++)
+	{
+		uint8_t *p = &t->buffer[((row - t->y) * t->width + (ix0 - t->x)) * 3];
+		for (int16_t i = ix0; i < ix1; i++)
+		{
+			*p++ = color.r;
+			*p++ = color.g;
+			*p++ = color.b;
+		}
+	}
+}
+
+void GFX_drawFastVLine(int16_t x, int16_t y, int16_t h, struct Color color)
+{
+	GFX_RECORD(.op = OP_VLINE, .a = {x, y, h}, .color = color);
+	if (h <= 0 || x < 0 || x >= (int16_t)_width)
+	{
+		return;
+	}
+	int32_t y0 = y < 0 ? 0 : y;
+	int32_t y1 = (int32_t)y + h < (int32_t)_height ? (int32_t)y + h : (int32_t)_height;
+	if (y0 >= y1)
+	{
+		return;
+	}
+	beginDraw();
+	fillArea(x, (int16_t)y0, 1, (int16_t)(y1 - y0), color);
+	endDraw();
+}
+
+void GFX_drawFastHLine(int16_t x, int16_t y, int16_t l, struct Color color)
+{
+	GFX_RECORD(.op = OP_HLINE, .a = {x, y, l}, .color = color);
+	if (l <= 0 || y < 0 || y >= (int16_t)_height)
+	{
+		return;
+	}
+	int32_t x0 = x < 0 ? 0 : x;
+	int32_t x1 = (int32_t)x + l < (int32_t)_width ? (int32_t)x + l : (int32_t)_width;
+	if (x0 >= x1)
+	{
+		return;
+	}
+	beginDraw();
+	fillArea((int16_t)x0, y, (int16_t)(x1 - x0), 1, color);
+	endDraw();
+}
+
+void GFX_fillRect(int16_t x, int16_t y, int16_t w, int16_t h, struct Color color)
+{
+	GFX_RECORD(.op = OP_FILL_RECT, .a = {x, y, w, h}, .color = color);
+	if (w <= 0 || h <= 0)
+	{
+		return;
+	}
+
+	if (x < 0)
+	{
+		w += x;
+		x = 0;
+	}
+	if (y < 0)
+	{
+		h += y;
+		y = 0;
+	}
+	if (x >= (int16_t)_width || y >= (int16_t)_height)
+	{
+		return;
+	}
+	if (x + w > (int16_t)_width)
+	{
+		w = (int16_t)_width - x;
+	}
+	if (y + h > (int16_t)_height)
+	{
+		h = (int16_t)_height - y;
+	}
+	if (w <= 0 || h <= 0)
+	{
+		return;
+	}
+
+	beginDraw();
+	fillArea(x, y, w, h, color);
+	endDraw();
+}
+
+void fillCircleHelper(int16_t x0, int16_t y0, int16_t r,
+					  uint8_t corners, int16_t delta,
+					  struct Color color)
+{
+
+	int16_t f = 1 - r;
+	int16_t ddF_x = 1;
+	int16_t ddF_y = -2 * r;
+	int16_t x = 0;
+	int16_t y = r;
+	int16_t px = x;
+	int16_t py = y;
+
+	delta++; // Avoid some +1's in the loop
+
+	while (x < y)
+	{
+		if (f >= 0)
+		{
+			y--;
+			ddF_y += 2;
+			f += ddF_y;
+		}
+		x++;
+		ddF_x += 2;
+		f += ddF_x;
+		// These checks avoid double-drawing certain lines, important
+		// for the SSD1306 library which has an INVERT drawing mode.
+		if (x < (y + 1))
+		{
+			if (corners & 1)
+				GFX_drawFastVLine(x0 + x, y0 - y, 2 * y + delta, color);
+			if (corners & 2)
+				GFX_drawFastVLine(x0 - x, y0 - y, 2 * y + delta, color);
+		}
+		if (y != py)
+		{
+			if (corners & 1)
+				GFX_drawFastVLine(x0 + py, y0 - px, 2 * px + delta, color);
+			if (corners & 2)
+				GFX_drawFastVLine(x0 - py, y0 - px, 2 * px + delta, color);
+			py = y;
+		}
+		px = x;
+	}
+}
+
+void GFX_fillRoundedRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t r, struct Color color)
+{
+	GFX_RECORD(.op = OP_FILL_ROUNDED_RECT, .a = {x, y, w, h, r}, .color = color);
+	if (w <= 0 || h <= 0) return;
+
+	if (r <= 0) {
+		GFX_fillRect(x, y, w, h, color);
+		return;
+	}
+
+	if (r > w / 2) r = w / 2;
+	if (r > h / 2) r = h / 2;
+
+	beginDraw();
+	// Fill the central rectangle (between rounded corners)
+	GFX_fillRect(x + r, y, w - 2 * r, h, color);
+
+	// Fill the rounded corners using helper (extends vertical spans by delta)
+	fillCircleHelper(x + w - r - 1, y + r, r, 1, h - 2 * r - 1, color); // Right corners
+	fillCircleHelper(x + r,           y + r, r, 2, h - 2 * r - 1, color); // Left corners
+	endDraw();
+}
+
+void GFX_drawRect(int16_t x, int16_t y, int16_t w, int16_t h, struct Color color)
+{
+	GFX_RECORD(.op = OP_RECT, .a = {x, y, w, h}, .color = color);
+	beginDraw();
+	GFX_drawFastHLine(x, y, w, color);
+	GFX_drawFastHLine(x, y + h - 1, w, color);
+	GFX_drawFastVLine(x, y, h, color);
+	GFX_drawFastVLine(x + w - 1, y, h, color);
+	endDraw();
+}
+
+void GFX_drawTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, struct Color color)
+{
+	GFX_RECORD(.op = OP_TRIANGLE, .a = {x0, y0, x1, y1, x2, y2}, .color = color);
+	beginDraw();
+	GFX_drawLine(x0, y0, x1, y1, color);
+	GFX_drawLine(x1, y1, x2, y2, color);
+	GFX_drawLine(x2, y2, x0, y0, color);
+	endDraw();
+}
+
+static void fillTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, struct Color color)
+{
+	int16_t a;
+	int16_t b;
+	int16_t y;
+	int32_t sa = 0;
+	int32_t sb = 0;
+
+	if (y0 > y1)
+	{
+		swap(y0, y1);
+		swap(x0, x1);
+	}
+	if (y1 > y2)
+	{
+		swap(y2, y1);
+		swap(x2, x1);
+	}
+	if (y0 > y1)
+	{
+		swap(y0, y1);
+		swap(x0, x1);
+	}
+
+	if (y0 == y2)
+	{
+		a = b = x0;
+		if (x1 < a)
+		{
+			a = x1;
+		}
+		else if (x1 > b)
+		{
+			b = x1;
+		}
+		if (x2 < a)
+		{
+			a = x2;
+		}
+		else if (x2 > b)
+		{
+			b = x2;
+		}
+		GFX_drawFastHLine(a, y0, b - a + 1, color);
+		return;
+	}
+
+	int16_t dx01 = x1 - x0;
+	int16_t dy01 = y1 - y0;
+	int16_t dx02 = x2 - x0;
+	int16_t dy02 = y2 - y0;
+	int16_t dx12 = x2 - x1;
+	int16_t dy12 = y2 - y1;
+
+	int16_t last;
+	if (y1 == y2)
+	{
+		last = y1;
+	}
+	else
+	{
+		last = y1 - 1;
+	}
+
+	for (y = y0; y <= last; y++)
+	{
+		a = x0 + sa / dy01;
+		b = x0 + sb / dy02;
+		sa += dx01;
+		sb += dx02;
+		if (a > b)
+		{
+			swap(a, b);
+		}
+		GFX_drawFastHLine(a, y, b - a + 1, color);
+	}
+
+	sa = (int32_t)dx12 * (int32_t)(y - y1);
+	sb = (int32_t)dx02 * (int32_t)(y - y0);
+	for (; y <= y2; y++)
+	{
+		a = x1 + sa / dy12;
+		b = x0 + sb / dy02;
+		sa += dx12;
 		sb += dx02;
 		if (a > b)
 		{
@@ -464,6 +1496,14 @@ void GFX_fillTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2
 	}
 }
 
+void GFX_fillTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, struct Color color)
+{
+	GFX_RECORD(.op = OP_FILL_TRIANGLE, .a = {x0, y0, x1, y1, x2, y2}, .color = color);
+	beginDraw();
+	fillTriangle(x0, y0, x1, y1, x2, y2, color);
+	endDraw();
+}
+
 unsigned char solveDiacritic(wchar_t wc, DIACRITIC* d) {
     // Map characters with diacritics to their base character and diacritic type
 	int i = wc;
@@ -565,12 +1605,122 @@ unsigned char solveDiacritic(wchar_t wc, DIACRITIC* d) {
     }
 }
 
-void drawDiacritic(int16_t x, int16_t y, unsigned char c, DIACRITIC diacritic, struct Color color,
-				  struct Color bg, uint8_t size_x, uint8_t size_y)
+// Pixel c of row r of a 1bpp image whose rows are stride bits apart, MSB first
+static inline bool bitAt(const uint8_t *bits, uint32_t stride, uint16_t r, uint16_t c)
 {
-	// Support sizes that are even multiples of 2 (2*n). For other sizes, skip.
-	if ((size_x % 2) != 0 || (size_y % 2) != 0)
-	{
+	uint32_t i = r * stride + c;
+	return bits[i >> 3] & (0x80 >> (i & 7));
+}
+
+// Sends the part of an opaque scaled image inside the screen and clip as one
+// memory write. Each source row is expanded once into a line buffer, repeated
+// size_y times there and sent while the next one is expanded.
+static void streamScaledBits(int16_t x, int16_t y, const uint8_t *bits, uint32_t stride, uint16_t w, uint16_t h,
+							 struct Color color, struct Color bg, uint8_t size_x, uint8_t size_y)
+{
+	int32_t x0 = x > clipX0 ? x : clipX0;
+	int32_t y0 = y > clipY0 ? y : clipY0;
+	int32_t x1 = (int32_t)x + w * size_x;
+	int32_t y1 = (int32_t)y + h * size_y;
+	x1 = x1 < clipX1 ? x1 : clipX1;
+	y1 = y1 < clipY1 ? y1 : clipY1;
+	x0 = x0 > 0 ? x0 : 0;
+	y0 = y0 > 0 ? y0 : 0;
+	x1 = x1 < (int32_t)_width ? x1 : (int32_t)_width;
+	y1 = y1 < (int32_t)_height ? y1 : (int32_t)_height;
+	if (x0 >= x1 || y0 >= y1)
+		return;
+	uint16_t vw = x1 - x0;
+	uint16_t rows = FLUSH_LINE_SIZE / (vw * 3);
+#ifdef USE_TILE_HASH
+	forgetTiles(x0, y0, vw, y1 - y0);
+#endif
+	uint8_t next = 0;
+	LCD_beginWrite();
+	for (int32_t dy = y0; dy < y1;)
+	{
+		uint16_t r = (dy - y) / size_y;
+		int32_t end = (int32_t)y + (r + 1) * size_y; // First row of the next source row
+		uint16_t n = (end < y1 ? end : y1) - dy;
+		n = n < rows ? n : rows;
+		// As in flushConverted, this buffer's last transfer is done by now
+		uint8_t *line = lineBuffers[next];
+		next ^= 1;
+		uint16_t c = (x0 - x) / size_x;
+		uint8_t phase = (x0 - x) % size_x;
+		uint8_t *p = line;
+		for (uint16_t i = 0; i < vw; i++, p += 3)
+		{
+			struct Color col = bitAt(bits, stride, r, c) ? color : bg;
+			p[0] = col.r;
+			p[1] = col.g;
+			p[2] = col.b;
+			if (++phase == size_x)
+			{
+				phase = 0;
+				c++;
+			}
+		}
+		for (uint16_t i = 1; i < n; i++)
+			memcpy(line + i * vw * 3, line, vw * 3);
+		// Rows below each other continue the same memory write
+		LCD_WriteBitmapAsync(x0, dy, vw, n, line);
+		dy += n;
+	}
+	LCD_waitForWrite();
+	LCD_endWrite();
+}
+
+// Draws a 1bpp image scaled by size_x, size_y, the pixels that are set in
+// color and, unless bg is the same colour, the others in bg. Opaque images
+// going straight to the display are streamed, anything else is drawn as
+// runs of pixels of one colour, a rectangle each.
+static void drawScaledBits(int16_t x, int16_t y, const uint8_t *bits, uint32_t stride, uint16_t w, uint16_t h,
+						   struct Color color, struct Color bg, uint8_t size_x, uint8_t size_y)
+{
+	bool opaque = isNotEqual(bg, color);
+	if (w == 0 || h == 0 || size_x == 0 || size_y == 0)
+		return;
+	if (opaque && fb.buffer == NULL && LCD_getColorMode() == LCD_COLOR_18BIT)
+	{
+		streamScaledBits(x, y, bits, stride, w, h, color, bg, size_x, size_y);
+		return;
+	}
+	for (uint16_t r = 0; r < h; r++)
+	{
+		uint16_t start = 0;
+		bool set = bitAt(bits, stride, r, 0);
+		for (uint16_t c = 1; c <= w; c++)
+		{
+			if (c < w && bitAt(bits, stride, r, c) == set)
+				continue;
+			if (set || opaque)
+				GFX_fillRect(x + start * size_x, y + r * size_y, (c - start) * size_x, size_y, set ? color : bg);
+			if (c < w)
+			{
+				start = c;
+				set = !set;
+			}
+		}
+	}
+}
+
+void GFX_drawBitmapScaled(int16_t x, int16_t y, const uint8_t *bitmap, uint16_t w, uint16_t h, struct Color color,
+						  struct Color bg, uint8_t size_x, uint8_t size_y)
+{
+	GFX_RECORD(.op = OP_BITMAP, .size_x = size_x, .size_y = size_y, .a = {x, y, w, h}, .color = color, .bg = bg,
+			   .bitmap = bitmap);
+	beginDraw();
+	drawScaledBits(x, y, bitmap, (w + 7) / 8 * 8, w, h, color, bg, size_x, size_y);
+	endDraw();
+}
+
+void drawDiacritic(int16_t x, int16_t y, unsigned char c, DIACRITIC diacritic, struct Color color,
+				  struct Color bg, uint8_t size_x, uint8_t size_y)
+{
+	// Support sizes that are even multiples of 2 (2*n). For other sizes, skip.
+	if ((size_x % 2) != 0 || (size_y % 2) != 0)
+	{
 		return;
 	}
 
@@ -578,349 +1728,1522 @@ void drawDiacritic(int16_t x, int16_t y, unsigned char c, DIACRITIC diacritic, s
 	uint8_t kx = size_x / 2;
 	uint8_t ky = size_y / 2;
 
-	int o = (isupper(c) ? 0 : 3) * ky;
+	int o = (isupper(c) ? 0 : 3) * ky;
+
+	// The marks as 1bpp images, columns 2 to 8 and rows 4 to 1 above the cell
+	static const uint8_t dot[] = {0x30, 0x48, 0x48, 0x30};
+	static const uint8_t caronT[] = {0x00, 0x02, 0x06, 0x04};
+	static const uint8_t caron[] = {0xCC, 0x78, 0x30, 0x00};
+	static const uint8_t acute[] = {0x0C, 0x18, 0x30, 0x00};
+	const uint8_t *mark = NULL;
+	if (diacritic == DIACRITIC_DOT)
+		mark = dot;
+	else if (diacritic == DIACRITIC_CARON)
+	{
+		if ('t' == c)
+			mark = caronT;
+		else if ('d' != c) // Not implemented for 'd': would exceed char bounds and clash with next glyph
+			mark = caron;
+	}
+	else if (diacritic == DIACRITIC_ACUTE)
+	{
+		// Background clear to refine shape, scaled
+		GFX_fillRect(x + 4 * kx, y + (-3) * ky + o, kx, ky, bg);
+		mark = acute;
+	}
+	if (mark != NULL)
+		drawScaledBits(x + 2 * kx, y + (-4) * ky + o, mark, 8, 7, 4, color, color, kx, ky);
+}
+
+#ifdef USE_GLYPH_CACHE
+// Built-in font glyphs drawn opaque to the display, rendered as they are sent
+struct CachedGlyph
+{
+	uint32_t lastUse; ///< 0 while the entry holds nothing
+	unsigned char c;  ///< Index into font[]
+	uint8_t size_x, size_y;
+	struct Color color, bg;
+	uint8_t pixels[GLYPH_CACHE_CELL_SIZE];
+};
+
+static struct CachedGlyph glyphCache[GLYPH_CACHE_ENTRIES];
+static uint32_t glyphUses = 0;
+
+static void renderGlyph(struct CachedGlyph *g)
+{
+	uint16_t w = 6 * g->size_x;
+	for (uint8_t i = 0; i < 6; i++)
+	{
+		uint8_t line = i < 5 ? font[g->c * 5 + i] : 0; // The last column is spacing
+		for (uint8_t j = 0; j < 8; j++, line >>= 1)
+		{
+			struct Color col = line & 1 ? g->color : g->bg;
+			for (uint16_t yy = j * g->size_y; yy < (j + 1) * g->size_y; yy++)
+			{
+				uint8_t *p = &g->pixels[(yy * w + i * g->size_x) * 3];
+				for (uint8_t xx = 0; xx < g->size_x; xx++, p += 3)
+				{
+					p[0] = col.r;
+					p[1] = col.g;
+					p[2] = col.b;
+				}
+			}
+		}
+	}
+}
+
+// Sends an opaque glyph of the built-in font from the cache, rendering it
+// there first if needed. Returns false for a glyph the cache can't send: one
+// going into a framebuffer, too large, or not wholly inside the clip.
+static bool drawCachedGlyph(int16_t x, int16_t y, unsigned char c, struct Color color, struct Color bg,
+							uint8_t size_x, uint8_t size_y)
+{
+	int16_t w = 6 * size_x, h = 8 * size_y;
+	if (fb.buffer != NULL || !isNotEqual(bg, color) || (uint32_t)w * h * 3 > GLYPH_CACHE_CELL_SIZE ||
+		LCD_getColorMode() != LCD_COLOR_18BIT)
+		return false;
+	if (x < 0 || y < 0 || x + w > (int16_t)_width || y + h > (int16_t)_height ||
+		x < clipX0 || y < clipY0 || x + w > clipX1 || y + h > clipY1)
+		return false;
+
+	struct CachedGlyph *g = NULL;
+	struct CachedGlyph *oldest = &glyphCache[0];
+	for (uint16_t i = 0; i < GLYPH_CACHE_ENTRIES && g == NULL; i++)
+	{
+		struct CachedGlyph *e = &glyphCache[i];
+		if (e->lastUse != 0 && e->c == c && e->size_x == size_x && e->size_y == size_y &&
+			!isNotEqual(e->color, color) && !isNotEqual(e->bg, bg))
+			g = e;
+		else if (e->lastUse < oldest->lastUse)
+			oldest = e;
+	}
+	if (g == NULL)
+	{
+		g = oldest;
+		LCD_waitForWrite(); // The entry may still be on its way out
+		g->c = c;
+		g->size_x = size_x;
+		g->size_y = size_y;
+		g->color = color;
+		g->bg = bg;
+		renderGlyph(g);
+	}
+	g->lastUse = ++glyphUses;
+	sendBitmap(x, y, w, h, g->pixels);
+	return true;
+}
+#endif
+
+static void drawChar(int16_t x, int16_t y, unsigned char c, struct Color color,
+					 struct Color bg, uint8_t size_x, uint8_t size_y, const GFXfont *gfxfont)
+{
+	if (!gfxfont)
+	{
+		if ((x >= _width) ||			  // Clip right
+			(y >= _height) ||			  // Clip bottom
+			((x + 6 * size_x - 1) < 0) || // Clip left
+			((y + 8 * size_y - 1) < 0))	  // Clip top
+			return;
+
+		DIACRITIC diacritic = DIACRITIC_NONE;
+		if( c >= 128)
+		{
+			wchar_t wc = wideCharacters[(uint8_t)c - 128];
+			c = solveDiacritic(wc, &diacritic);
+		}
+		
+		if (c >= 176)
+			c++; // Handle 'classic' charset behavior
+
+#ifdef USE_GLYPH_CACHE
+		// Diacritics are drawn above the cell
+		if (diacritic == DIACRITIC_NONE && drawCachedGlyph(x, y, c, color, bg, size_x, size_y))
+			return;
+#endif
+		// The 5 columns turned into rows, the 6th column is spacing
+		uint8_t rows[8] = {0};
+		for (uint8_t i = 0; i < 5; i++)
+		{
+			uint8_t line = font[c * 5 + i];
+			for (uint8_t j = 0; j < 8; j++, line >>= 1)
+			{
+				if (line & 1)
+					rows[j] |= 0x80 >> i;
+			}
+		}
+		if (diacritic == DIACRITIC_NONE)
+		{
+			// Opaque, the spacing column goes with the rest
+			drawScaledBits(x, y, rows, 8, isNotEqual(bg, color) ? 6 : 5, 8, color, bg, size_x, size_y);
+		}
+		else
+		{
+			// The mark may reach into the spacing column, which is drawn over it
+			drawScaledBits(x, y, rows, 8, 5, 8, color, bg, size_x, size_y);
+			drawDiacritic(x, y, c, diacritic, color, bg, size_x, size_y);
+			if (isNotEqual(bg, color))
+				GFX_fillRect(x + 5 * size_x, y, size_x, 8 * size_y, bg);
+		}
+	}
+	else
+	{
+		c -= (uint8_t)gfxfont->first;
+		GFXglyph *glyph = (gfxfont->glyph) + c;
+		// Custom font glyphs are drawn without background
+		drawScaledBits(x + glyph->xOffset * size_x, y + glyph->yOffset * size_y, gfxfont->bitmap + glyph->bitmapOffset,
+					   glyph->width, glyph->width, glyph->height, color, color, size_x, size_y);
+	}
+}
+
+void GFX_drawChar(int16_t x, int16_t y, unsigned char c, struct Color color,
+				  struct Color bg, uint8_t size_x, uint8_t size_y)
+{
+	GFX_RECORD(.op = OP_CHAR, .c = c, .size_x = size_x, .size_y = size_y, .a = {x, y}, .color = color, .bg = bg,
+			   .font = gfxFont);
+	beginDraw();
+	drawChar(x, y, c, color, bg, size_x, size_y, gfxFont);
+	endDraw();
+}
+
+#ifdef USE_SCROLL_CONSOLE
+// The console area is a ring of lines in display memory. Its contents have
+// moved up by offset rows, so line y of the screen is kept offset rows lower.
+static struct
+{
+	bool active;
+	int16_t top;		///< First row of the scrolling area
+	int16_t height;		///< Rows of the scrolling area, whole lines
+	int16_t lineHeight; ///< Rows of one line of text
+	int16_t offset;		///< Rows the contents have scrolled up by
+} console;
+
+static void setScrollArea(int16_t top, int16_t bottom)
+{
+	GFX_POST(.op = OP_SCROLL_AREA, .a = {top, bottom});
+	LCD_setScrollArea(top, bottom);
+}
+
+static void setScrollStart(int16_t row)
+{
+	GFX_POST(.op = OP_SCROLL_START, .a = {row});
+	LCD_setScrollStart(row);
+}
+
+// Memory row that screen row y of the console is kept in
+static int16_t consoleRow(int16_t y)
+{
+	if (!console.active || y < console.top || y >= console.top + console.height)
+		return y;
+	return console.top + (y - console.top + console.offset) % console.height;
+}
+
+// Called after the cursor went down one line. Past the last line, the area
+// scrolls by one line and the line coming in at the bottom is cleared.
+static void consoleNewLine()
+{
+	int16_t end = console.top + console.height;
+	int16_t last = cursor_y - console.lineHeight; // Line the cursor was on
+	if (!console.active || last < console.top || last >= end || cursor_y + console.lineHeight <= end)
+		return;
+	console.offset = (console.offset + console.lineHeight) % console.height;
+	setScrollStart(console.top + console.offset);
+	cursor_y = end - console.lineHeight;
+	GFX_fillRect(0, consoleRow(cursor_y), _width, console.lineHeight, textbgcolor);
+}
+
+bool GFX_startConsole(uint16_t top, uint16_t bottom, uint8_t textsize)
+{
+	int16_t lineHeight = textsize * 8;
+	int16_t height = ILI9488_TFTHEIGHT - top - bottom;
+	if (LCD_getRotation() != 0 || lineHeight == 0 || height < lineHeight)
+		return false;
+	height -= height % lineHeight;
+	console.active = true;
+	console.top = top;
+	console.height = height;
+	console.lineHeight = lineHeight;
+	console.offset = 0;
+	setScrollArea(top, ILI9488_TFTHEIGHT - top - height);
+	setScrollStart(top);
+	GFX_fillRect(0, top, _width, height, textbgcolor);
+	cursor_x = 0;
+	cursor_y = top;
+	return true;
+}
+
+void GFX_stopConsole()
+{
+	if (!console.active)
+		return;
+	console.active = false;
+	setScrollArea(0, 0);
+	setScrollStart(0);
+}
+#endif
+
+void GFX_write(uint8_t c, uint8_t textsize)
+{
+	uint8_t textsize_y = textsize;
+	uint8_t textsize_x = textsize;
+	if (!gfxFont)
+	{
+		if (c == '\n')
+		{								// Newline?
+			cursor_x = 0;				// Reset x to zero,
+			cursor_y += textsize_y * 8; // advance y one line
+#ifdef USE_SCROLL_CONSOLE
+			consoleNewLine();
+#endif
+		}
+		else if (c != '\r')
+		{ // Ignore carriage returns
+			if (wrap && ((cursor_x + textsize_x * 6) > _width))
+			{								// Off right?
+				cursor_x = 0;				// Reset x to zero,
+				cursor_y += textsize_y * 8; // advance y one line
+#ifdef USE_SCROLL_CONSOLE
+				consoleNewLine();
+#endif
+			}
+#ifdef USE_SCROLL_CONSOLE
+			GFX_drawChar(cursor_x, consoleRow(cursor_y), c, textcolor, textbgcolor,
+						 textsize_x, textsize_y);
+#else
+			GFX_drawChar(cursor_x, cursor_y, c, textcolor, textbgcolor,
+						 textsize_x, textsize_y);
+#endif
+			cursor_x += textsize_x * 6; // Advance x one char
+		}
+	}
+	else
+	{
+		if (c == '\n')
+		{
+			cursor_x = 0;
+			cursor_y += (int16_t)textsize_y * (uint8_t)(gfxFont->yAdvance);
+		}
+		else if (c != '\r')
+		{
+			uint8_t first = gfxFont->first;
+			if ((c >= first) && (c <= (uint8_t)gfxFont->last))
+			{
+				GFXglyph *glyph = (gfxFont->glyph) + (c - first);
+				uint8_t w = glyph->width, h = glyph->height;
+				if ((w > 0) && (h > 0))
+				{										 // Is there an associated bitmap?
+					int16_t xo = (int8_t)glyph->xOffset; // sic
+					if (wrap && ((cursor_x + textsize_x * (xo + w)) > _width))
+					{
+						cursor_x = 0;
+						cursor_y += (int16_t)textsize_y * (uint8_t)gfxFont->yAdvance;
+					}
+					GFX_drawChar(cursor_x, cursor_y, c, textcolor,
+								 textbgcolor, textsize_x, textsize_y);
+				}
+				cursor_x += (uint8_t)glyph->xAdvance * (int16_t)textsize_x;
+			}
+		}
+	}
+}
+
+void GFX_setCursor(int16_t x, int16_t y)
+{
+	cursor_x = x;
+	cursor_y = y;
+}
+
+void GFX_setTextColor(struct Color color)
+{
+	textcolor = color;
+}
+
+void GFX_setTextBack(struct Color color)
+{
+	textbgcolor = color;
+}
+
+void GFX_setFont(const GFXfont *f)
+{
+	if (f)
+	{ // Font struct pointer passed in?
+		if (!gfxFont)
+		{ // And no current font struct?
+			// Switching from classic to new font behavior.
+			// Move cursor pos down 6 pixels so it's on baseline.
+			cursor_y += 6;
+		}
+	}
+	else if (gfxFont)
+	{ // NULL passed.  Current font struct defined?
+		// Switching from new to classic font behavior.
+		// Move cursor pos up 6 pixels so it's at top-left of char.
+		cursor_y -= 6;
+	}
+	gfxFont = (GFXfont *)f;
+}
+
+void GFX_fillCircle(int16_t x0, int16_t y0, int16_t r,
+					struct Color color)
+{
+	GFX_RECORD(.op = OP_FILL_CIRCLE, .a = {x0, y0, r}, .color = color);
+	beginDraw();
+	GFX_drawFastVLine(x0, y0 - r, 2 * r + 1, color);
+	fillCircleHelper(x0, y0, r, 3, 0, color);
+	endDraw();
+}
+
+void GFX_drawCircle(int16_t x0, int16_t y0, int16_t r, struct Color color)
+{
+	GFX_RECORD(.op = OP_CIRCLE, .a = {x0, y0, r}, .color = color);
+
+	int16_t f = 1 - r;
+	int16_t ddF_x = 1;
+	int16_t ddF_y = -2 * r;
+	int16_t x = 0;
+	int16_t y = r;
+
+	beginDraw();
+	GFX_drawPixel(x0, y0 + r, color);
+	GFX_drawPixel(x0, y0 - r, color);
+	GFX_drawPixel(x0 + r, y0, color);
+	GFX_drawPixel(x0 - r, y0, color);
+
+	while (x < y)
+	{
+		if (f >= 0)
+		{
+			y--;
+			ddF_y += 2;
+			f += ddF_y;
+		}
+		x++;
+		ddF_x += 2;
+		f += ddF_x;
+
+		GFX_drawPixel(x0 + x, y0 + y, color);
+		GFX_drawPixel(x0 - x, y0 + y, color);
+		GFX_drawPixel(x0 + x, y0 - y, color);
+		GFX_drawPixel(x0 - x, y0 - y, color);
+		GFX_drawPixel(x0 + y, y0 + x, color);
+		GFX_drawPixel(x0 - y, y0 + x, color);
+		GFX_drawPixel(x0 + y, y0 - x, color);
+		GFX_drawPixel(x0 - y, y0 - x, color);
+	}
+	endDraw();
+}
+
+// An area drawn off screen and sent with one write, see beginStrip
+struct Strip
+{
+	struct RenderTarget screen; ///< Where drawing went before
+	uint32_t bytes;
+};
+
+// Points drawing at a buffer of its own covering an area, which endStrip
+// sends. Only when drawing goes straight to the display from this core and the
+// area lies inside the screen and clip. Nothing drawn outside of it shows.
+static bool beginStrip(struct Strip *strip, int16_t x, int16_t y, int16_t w, int16_t h)
+{
+	uint32_t bytes = (uint32_t)w * h * 3;
+	if (!DRAWS_HERE() || fb.buffer != NULL || LCD_getColorMode() != LCD_COLOR_18BIT || w <= 0 || h <= 0 ||
+		bytes > BUFFER_MAX_SIZE)
+		return false;
+#ifdef USE_DISPLAY_LIST
+	if (recording)
+		return false;
+#endif
+	if (x < clipX0 || x < 0 || y < clipY0 || y < 0 || x + w > clipX1 || x + w > (int16_t)_width || y + h > clipY1 ||
+		y + h > (int16_t)_height)
+		return false;
+	uint8_t *buffer = framebufAcquire(bytes);
+	if (buffer == NULL)
+		return false;
+	strip->screen = fb;
+	strip->bytes = bytes;
+	fb = (struct RenderTarget){buffer, x, y, w, h, true, GFX_FORMAT_RGB666};
+	return true;
+}
+
+static void endStrip(struct Strip *strip)
+{
+	struct RenderTarget t = fb;
+	fb = strip->screen;
+	sendBitmap(t.x, t.y, t.width, t.height, t.buffer);
+	LCD_waitForWrite();
+	framebufRelease(t.buffer, strip->bytes);
+}
+
+#ifdef USE_TEXT_RUNS
+// Draws the characters of s that fit on the line from the cursor on into a
+// strip of their own and sends it with one write. Returns how many it drew,
+// 0 when they have to go through GFX_write one by one.
+static uint16_t printRun(const char *s, uint16_t n, uint8_t textsize)
+{
+	int16_t cw = 6 * textsize, h = 8 * textsize;
+#ifdef USE_SCROLL_CONSOLE
+	int16_t y = consoleRow(cursor_y);
+#else
+	int16_t y = cursor_y;
+#endif
+	// Built-in font text with a background only, the strip hides what was there
+	if (gfxFont || !isNotEqual(textcolor, textbgcolor) || textsize == 0)
+		return 0;
+	int32_t right = clipX1 < (int16_t)_width ? clipX1 : (int16_t)_width;
+	uint16_t count = 0;
+	// Line ends, wraps and characters with diacritics are left to GFX_write
+	while (count < n && s[count] != '\n' && s[count] != '\r' && (uint8_t)s[count] < 128 &&
+		   cursor_x + (int32_t)(count + 1) * cw <= right && (uint32_t)(count + 1) * cw * h * 3 <= BUFFER_MAX_SIZE)
+		count++;
+	struct Strip strip;
+	if (count == 0 || !beginStrip(&strip, cursor_x, y, count * cw, h))
+		return 0;
+	for (uint16_t i = 0; i < count; i++, cursor_x += cw)
+		GFX_drawChar(cursor_x, y, s[i], textcolor, textbgcolor, textsize, textsize);
+	endStrip(&strip);
+	return count;
+}
+#endif
+
+// Writes n characters of s at the cursor
+static void printText(const char *s, size_t n, uint8_t textsize)
+{
+	bool drawsHere = DRAWS_HERE(); // Otherwise the characters are posted to the render core
+	if (drawsHere)
+		LCD_beginWrite();
+	for (size_t i = 0; i < n;)
+	{
+#ifdef USE_TEXT_RUNS
+		uint16_t run = drawsHere ? printRun(&s[i], n - i < UINT16_MAX ? n - i : UINT16_MAX, textsize) : 0;
+		if (run > 0)
+		{
+			i += run;
+			continue;
+		}
+#endif
+		GFX_write(s[i++], textsize);
+	}
+	if (drawsHere)
+		LCD_endWrite();
+}
+
+// Text being formatted into a buffer, cut off where the buffer ends
+struct TextOut
+{
+	char *buf;
+	size_t size; ///< Of buf, with the terminating 0
+	size_t len;	 ///< Characters formatted, also those that didn't fit
+};
+
+static void putChar(struct TextOut *out, char c)
+{
+	if (out->len + 1 < out->size)
+		out->buf[out->len] = c;
+	out->len++;
+}
+
+static void putChars(struct TextOut *out, const char *s, size_t n)
+{
+	while (n--)
+		putChar(out, *s++);
+}
+
+// Digits of v in base 10 or 16, the most significant first, returns how many
+static uint8_t formatDigits(char *digits, unsigned long v, uint8_t base, bool upper)
+{
+	const char *symbols = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	char reversed[3 * sizeof(v)];
+	uint8_t n = 0;
+	do
+	{
+		reversed[n++] = symbols[v % base];
+		v /= base;
+	} while (v);
+	for (uint8_t i = 0; i < n; i++)
+		digits[i] = reversed[n - 1 - i];
+	return n;
+}
+
+// A converted field, padded to width: spaces in front, zeros after the sign
+// or spaces behind
+static void putField(struct TextOut *out, const char *sign, const char *s, size_t n, uint16_t width, bool left,
+					 bool zeros)
+{
+	size_t signLen = strlen(sign);
+	size_t pad = width > signLen + n ? width - signLen - n : 0;
+	for (; !left && !zeros && pad > 0; pad--)
+		putChar(out, ' ');
+	putChars(out, sign, signLen);
+	for (; !left && pad > 0; pad--)
+		putChar(out, '0');
+	putChars(out, s, n);
+	for (; pad > 0; pad--)
+		putChar(out, ' ');
+}
+
+// vsnprintf for GFX_printf. Integers, characters and strings with the - and 0
+// flags, a width and the h and l lengths are converted here. From the first
+// conversion that needs more on, the rest goes to vsnprintf. Returns the
+// length of the text, which is cut to size - 1 characters.
+static size_t formatText(char *buf, size_t size, const char *format, va_list args)
+{
+	struct TextOut out = {buf, size, 0};
+	const char *p = format;
+	while (*p)
+	{
+		if (*p != '%')
+		{
+			putChar(&out, *p++);
+			continue;
+		}
+		const char *spec = p++;
+		bool left = false, zeros = false;
+		for (;; p++)
+		{
+			if (*p == '-')
+				left = true;
+			else if (*p == '0')
+				zeros = true;
+			else
+				break;
+		}
+		uint16_t width = 0;
+		while (*p >= '0' && *p <= '9')
+			width = width * 10 + (*p++ - '0');
+		char length = 0; ///< 'l', 'h', or 'H' for hh
+		if (*p == 'l' || *p == 'h')
+			length = *p++;
+		if (length == 'h' && *p == 'h')
+		{
+			length = 'H';
+			p++;
+		}
+		char digits[3 * sizeof(unsigned long)];
+		char c = *p++;
+		if (c == 'd' || c == 'i')
+		{
+			long v = length == 'l' ? va_arg(args, long) : va_arg(args, int);
+			// Short arguments arrive promoted to int, narrowed back like printf does
+			if (length == 'h')
+				v = (short)v;
+			else if (length == 'H')
+				v = (signed char)v;
+			unsigned long magnitude = v < 0 ? 0UL - (unsigned long)v : (unsigned long)v;
+			uint8_t n = formatDigits(digits, magnitude, 10, false);
+			putField(&out, v < 0 ? "-" : "", digits, n, width, left, zeros);
+		}
+		else if (c == 'u' || c == 'x' || c == 'X')
+		{
+			unsigned long v = length == 'l' ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+			if (length == 'h')
+				v = (unsigned short)v;
+			else if (length == 'H')
+				v = (unsigned char)v;
+			uint8_t n = formatDigits(digits, v, c == 'u' ? 10 : 16, c == 'X');
+			putField(&out, "", digits, n, width, left, zeros);
+		}
+		else if (c == 'c' && length == 0)
+		{
+			char ch = va_arg(args, int);
+			putField(&out, "", &ch, 1, width, left, false);
+		}
+		else if (c == 's' && length == 0)
+		{
+			const char *str = va_arg(args, const char *);
+			if (str == NULL)
+				str = "(null)";
+			putField(&out, "", str, strlen(str), width, left, false);
+		}
+		else if (c == '%' && p == spec + 2)
+			putChar(&out, '%');
+		else
+		{
+			// Precision, floats, other flags and lengths
+			size_t kept = out.len < size ? out.len : size - 1;
+			int rest = vsnprintf(buf + kept, size - kept, spec, args);
+			out.len += rest > 0 ? rest : 0;
+			break;
+		}
+	}
+	if (size > 0)
+		buf[out.len < size ? out.len : size - 1] = 0;
+	return out.len < size ? out.len : size - 1;
+}
+
+void GFX_printf(uint8_t textsize, const char *format, ...)
+{
+	char text[GFX_PRINTF_SIZE];
+	va_list args;
+	va_start(args, format);
+	size_t n = formatText(text, sizeof(text), format, args);
+	va_end(args);
+	printText(text, n, textsize);
+}
+
+void GFX_printFixed(int32_t value, uint8_t decimals, uint8_t textsize)
+{
+	char text[24];
+	char digits[3 * sizeof(unsigned long)];
+	if (decimals > 9)
+		decimals = 9;
+	unsigned long magnitude = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+	uint8_t count = formatDigits(digits, magnitude, 10, false);
+	uint8_t whole = count > decimals ? count - decimals : 0; ///< Digits in front of the point
+	size_t n = 0;
+	if (value < 0)
+		text[n++] = '-';
+	if (whole == 0)
+		text[n++] = '0';
+	for (uint8_t i = 0; i < whole; i++)
+		text[n++] = digits[i];
+	if (decimals > 0)
+	{
+		text[n++] = '.';
+		for (uint8_t i = count - whole; i < decimals; i++)
+			text[n++] = '0';
+		for (uint8_t i = whole; i < count; i++)
+			text[n++] = digits[i];
+	}
+	printText(text, n, textsize);
+}
+
+// Moves the pen over one character the way GFX_write moves the cursor and
+// widens the bounds by the pixels the character covers
+static void charBounds(unsigned char c, int16_t *x, int16_t *y, uint8_t textsize, bool wrapLines, int16_t *minx,
+					   int16_t *miny, int16_t *maxx, int16_t *maxy)
+{
+	int16_t x0, y0, x1, y1;
+	if (!gfxFont)
+	{
+		if (c == '\n')
+		{
+			*x = 0;
+			*y += textsize * 8;
+			return;
+		}
+		if (c == '\r')
+			return;
+		if (wrapLines && *x + textsize * 6 > (int16_t)_width)
+		{
+			*x = 0;
+			*y += textsize * 8;
+		}
+		x0 = *x;
+		y0 = *y;
+		x1 = *x + textsize * 6 - 1;
+		y1 = *y + textsize * 8 - 1;
+		*x += textsize * 6;
+	}
+	else
+	{
+		if (c == '\n')
+		{
+			*x = 0;
+			*y += textsize * (uint8_t)gfxFont->yAdvance;
+			return;
+		}
+		if (c == '\r' || c < (uint8_t)gfxFont->first || c > (uint8_t)gfxFont->last)
+			return;
+		GFXglyph *glyph = gfxFont->glyph + (c - (uint8_t)gfxFont->first);
+		uint8_t w = glyph->width, h = glyph->height;
+		if (w == 0 || h == 0)
+		{
+			*x += (uint8_t)glyph->xAdvance * (int16_t)textsize;
+			return; // A space
+		}
+		if (wrapLines && *x + textsize * (glyph->xOffset + w) > (int16_t)_width)
+		{
+			*x = 0;
+			*y += textsize * (uint8_t)gfxFont->yAdvance;
+		}
+		x0 = *x + glyph->xOffset * textsize;
+		y0 = *y + glyph->yOffset * textsize;
+		x1 = x0 + w * textsize - 1;
+		y1 = y0 + h * textsize - 1;
+		*x += (uint8_t)glyph->xAdvance * (int16_t)textsize;
+	}
+	*minx = x0 < *minx ? x0 : *minx;
+	*miny = y0 < *miny ? y0 : *miny;
+	*maxx = x1 > *maxx ? x1 : *maxx;
+	*maxy = y1 > *maxy ? y1 : *maxy;
+}
+
+static void textBounds(const char *s, size_t n, int16_t x, int16_t y, uint8_t textsize, bool wrapLines, int16_t *x1,
+					   int16_t *y1, uint16_t *w, uint16_t *h)
+{
+	int16_t minx = INT16_MAX, miny = INT16_MAX, maxx = INT16_MIN, maxy = INT16_MIN;
+	*x1 = x;
+	*y1 = y;
+	for (size_t i = 0; i < n; i++)
+		charBounds(s[i], &x, &y, textsize, wrapLines, &minx, &miny, &maxx, &maxy);
+	if (maxx < minx)
+	{
+		*w = *h = 0; // Nothing that draws
+		return;
+	}
+	*x1 = minx;
+	*y1 = miny;
+	*w = maxx - minx + 1;
+	*h = maxy - miny + 1;
+}
+
+void GFX_getTextBounds(const char *s, int16_t x, int16_t y, uint8_t textsize, int16_t *x1, int16_t *y1, uint16_t *w,
+					   uint16_t *h)
+{
+	textBounds(s, strlen(s), x, y, textsize, wrap, x1, y1, w, h);
+}
+
+void GFX_drawTextBox(int16_t x, int16_t y, int16_t w, int16_t h, uint8_t align, uint8_t textsize, const char *s)
+{
+	if (w <= 0 || h <= 0 || textsize == 0)
+		return;
+	bool opaque = isNotEqual(textcolor, textbgcolor);
+	struct Strip strip;
+	bool ownStrip = opaque && beginStrip(&strip, x, y, w, h);
+	bool drawsHere = DRAWS_HERE(); // Otherwise the calls are posted to the render core
+	if (drawsHere && !ownStrip)
+		LCD_beginWrite();
+	if (opaque)
+		GFX_fillRect(x, y, w, h, textbgcolor);
+
+	int16_t bx, by;
+	uint16_t bw, bh;
+	textBounds(s, strlen(s), 0, 0, textsize, false, &bx, &by, &bw, &bh);
+	int16_t lineHeight = textsize * (gfxFont ? (uint8_t)gfxFont->yAdvance : 8);
+	int16_t penY = y - by;
+	if (align & GFX_ALIGN_MIDDLE)
+		penY += (h - (int16_t)bh) / 2;
+	else if (align & GFX_ALIGN_BOTTOM)
+		penY += h - (int16_t)bh;
+	const char *line = s;
+	while (*line)
+	{
+		size_t n = strcspn(line, "\n");
+		int16_t lx, ly;
+		uint16_t lw, lh;
+		textBounds(line, n, 0, 0, textsize, false, &lx, &ly, &lw, &lh);
+		int16_t penX = x - lx;
+		if (align & GFX_ALIGN_CENTER)
+			penX += (w - (int16_t)lw) / 2;
+		else if (align & GFX_ALIGN_RIGHT)
+			penX += w - (int16_t)lw;
+		for (size_t i = 0; i < n; i++)
+		{
+			int16_t cx = penX, cy = penY;
+			int16_t minx = INT16_MAX, miny = INT16_MAX, maxx = INT16_MIN, maxy = INT16_MIN;
+			charBounds(line[i], &penX, &penY, textsize, false, &minx, &miny, &maxx, &maxy);
+			if (maxx < minx)
+				continue;
+			// Outside of a strip, a character has to fit in the box whole to be drawn
+			if (!ownStrip && (minx < x || miny < y || maxx >= x + w || maxy >= y + h))
+				continue;
+			// Over the filled box, only the strip's characters need their background
+			GFX_drawChar(cx, cy, line[i], textcolor, ownStrip ? textbgcolor : textcolor, textsize, textsize);
+		}
+		line += n;
+		if (*line == '\n')
+		{
+			line++;
+			penY += lineHeight;
+		}
+	}
+
+	if (ownStrip)
+		endStrip(&strip);
+	else if (drawsHere)
+		LCD_endWrite();
+}
+
+void GFX_createFramebuf(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+	GFX_POST(.op = OP_CREATE_FRAMEBUF, .a = {x, y, w, h});
+	if (!framebufAllowed(framebufFormat, w, h, 1)) //e.g. 200p x 200p square
+	{
+		return;
+	}
+	if (fb.buffer != NULL)
+	{
+		GFX_destroyFramebuf();
+	}
+	fb.x = x;
+	fb.y = y;
+	fb.width = w;
+	fb.height = h;
+	fb.format = framebufFormat;
+	fb.buffer = framebufAcquire(framebufBytes(fb.format, w, h));
+}
+
+void GFX_createDoubleFramebuf(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+	GFX_POST(.op = OP_CREATE_DOUBLE_FRAMEBUF, .a = {x, y, w, h});
+	if (!framebufAllowed(framebufFormat, w, h, 2))
+	{
+		return;
+	}
+	GFX_createFramebuf(x, y, w, h);
+	if (fb.buffer != NULL)
+	{
+		backFramebuffer = framebufAcquire(framebufBytes(fb.format, w, h));
+	}
+}
+
+void GFX_moveFramebuf(uint16_t x, uint16_t y)
+{
+	GFX_POST(.op = OP_MOVE_FRAMEBUF, .a = {x, y});
+	fb.x = x;
+	fb.y = y;
+}
+
+bool hasFrameBuffer()
+{
+#ifdef USE_RENDER_QUEUE
+	if (!DRAWS_HERE())
+	{
+		// The render core has the framebuffer, ask once it has caught up
+		GFX_waitFence(GFX_fence());
+		return renderTarget[RENDER_CORE].buffer != NULL;
+	}
+#endif
+	return fb.buffer != NULL;
+}
+
+void GFX_setFramebufFormat(enum GFX_PixelFormat format)
+{
+	GFX_POST(.op = OP_SET_FORMAT, .c = format);
+	switch (format)
+	{
+#ifdef USE_INDEXED_FRAMEBUF
+	case GFX_FORMAT_INDEXED8:
+#endif
+#ifdef USE_RGB565_FRAMEBUF
+	case GFX_FORMAT_RGB565:
+#endif
+#ifdef USE_RGB111_FRAMEBUF
+	case GFX_FORMAT_RGB111:
+#endif
+	case GFX_FORMAT_RGB666:
+		framebufFormat = format;
+		break;
+	default:
+		break; // Not compiled in
+	}
+}
+
+#ifdef USE_INDEXED_FRAMEBUF
+void GFX_setPaletteColor(uint8_t index, struct Color color)
+{
+	GFX_POST(.op = OP_SET_PALETTE_COLOR, .c = index, .color = color);
+	if (!paletteSet)
+		initPalette();
+	palette[index] = color;
+	lastIndex = -1;
+}
+
+void GFX_setPalette(const struct Color *colors, uint16_t count)
+{
+	for (uint16_t i = 0; i < count && i < 256; i++)
+		GFX_setPaletteColor(i, colors[i]);
+}
+
+struct Color GFX_getPaletteColor(uint8_t index)
+{
+	if (!paletteSet)
+		initPalette();
+	return palette[index];
+}
+#endif
+void GFX_destroyFramebuf()
+{
+	GFX_POST(.op = OP_DESTROY_FRAMEBUF);
+	// The DMA may still be reading one of the buffers
+	LCD_waitForWrite();
+	framebufRelease(fb.buffer, framebufBytes(fb.format, fb.width, fb.height));
+	framebufRelease(backFramebuffer, framebufBytes(fb.format, fb.width, fb.height));
+	fb.x = 0;
+	fb.y = 0;
+	fb.width = 0;
+	fb.height = 0;
+	fb.buffer = NULL;
+	backFramebuffer = NULL;
+}
+
+uint32_t GFX_getFramebufHighWater()
+{
+	return framebufHighWater;
+}
 
-	if (diacritic == DIACRITIC_DOT)
-	{
-		// Original pixels replicated as rectangles scaled by kx x ky
-		GFX_fillRect(x + 4 * kx, y + (-1) * ky + o, kx, ky, color);
-		GFX_fillRect(x + 5 * kx, y + (-1) * ky + o, kx, ky, color);
-		GFX_fillRect(x + 4 * kx, y + (-4) * ky + o, kx, ky, color);
-		GFX_fillRect(x + 5 * kx, y + (-4) * ky + o, kx, ky, color);
-		GFX_fillRect(x + 3 * kx, y + (-2) * ky + o, kx, ky, color);
-		GFX_fillRect(x + 3 * kx, y + (-3) * ky + o, kx, ky, color);
-		GFX_fillRect(x + 6 * kx, y + (-2) * ky + o, kx, ky, color);
-		GFX_fillRect(x + 6 * kx, y + (-3) * ky + o, kx, ky, color);
-	}
-	else if (diacritic == DIACRITIC_CARON)
+void GFX_resetFramebufHighWater()
+{
+#ifdef USE_FRAMEBUFFER_ARENA
+	framebufHighWater = arenaTop();
+#else
+	framebufHighWater = framebufInUse;
+#endif
+}
+
+void GFX_flush()
+{
+	GFX_POST(.op = OP_FLUSH);
+#ifdef USE_RGB111_FRAMEBUF
+	if (fb.buffer != NULL && fb.format == GFX_FORMAT_RGB111 && LCD_getColorMode() == LCD_COLOR_3BIT)
 	{
-		if ('t' == c)
-		{
-			GFX_fillRect(x + 7 * kx, y + (-1) * ky + o, kx, ky, color);
-			GFX_fillRect(x + 7 * kx, y + (-2) * ky + o, kx, ky, color);
-			GFX_fillRect(x + 8 * kx, y + (-2) * ky + o, kx, ky, color);
-			GFX_fillRect(x + 8 * kx, y + (-3) * ky + o, kx, ky, color);
-		}
-		else if ('d' == c)
+		// Sent as it is. An odd last half byte wraps around to the first pixel.
+		uint32_t pixels = (uint32_t)fb.width * fb.height;
+		if (pixels & 1)
+			putPixel3(fb.buffer, pixels, getPixel3(fb.buffer, 0));
+#ifdef USE_TILE_HASH
+		forgetTiles(fb.x, fb.y, fb.width, fb.height);
+#endif
+		LCD_WritePacked(fb.x, fb.y, fb.width, fb.height, fb.buffer);
+		if (backFramebuffer != NULL)
 		{
-			// Intentionally not implemented: would exceed char bounds and clash with next glyph
+			uint8_t *sent = fb.buffer;
+			fb.buffer = backFramebuffer;
+			backFramebuffer = sent;
 		}
-		else
+		return;
+	}
+#endif
+#if defined(USE_INDEXED_FRAMEBUF) || defined(USE_RGB565_FRAMEBUF) || defined(USE_RGB111_FRAMEBUF)
+	if (fb.buffer != NULL && fb.format != GFX_FORMAT_RGB666)
+	{
+		// Sent by the time this returns, so the buffers can be swapped right away
+		flushConverted(&fb);
+		if (backFramebuffer != NULL)
 		{
-			GFX_fillRect(x + 4 * kx, y + (-2) * ky + o, kx, ky, color);
-			GFX_fillRect(x + 5 * kx, y + (-2) * ky + o, kx, ky, color);
-			GFX_fillRect(x + 3 * kx, y + (-3) * ky + o, kx, ky, color);
-			GFX_fillRect(x + 4 * kx, y + (-3) * ky + o, kx, ky, color);
-			GFX_fillRect(x + 5 * kx, y + (-3) * ky + o, kx, ky, color);
-			GFX_fillRect(x + 6 * kx, y + (-3) * ky + o, kx, ky, color);
-			GFX_fillRect(x + 3 * kx, y + (-4) * ky + o, kx, ky, color);
-			GFX_fillRect(x + 2 * kx, y + (-4) * ky + o, kx, ky, color);
-			GFX_fillRect(x + 7 * kx, y + (-4) * ky + o, kx, ky, color);
-			GFX_fillRect(x + 6 * kx, y + (-4) * ky + o, kx, ky, color);
+			uint8_t *sent = fb.buffer;
+			fb.buffer = backFramebuffer;
+			backFramebuffer = sent;
 		}
+		return;
 	}
-	else if (diacritic == DIACRITIC_ACUTE)
+#endif
+	if (fb.buffer != NULL && backFramebuffer != NULL)
 	{
-		// Background clear to refine shape, scaled
-		GFX_fillRect(x + 4 * kx, y + (-3) * ky + o, kx, ky, bg);
-
-		GFX_fillRect(x + 4 * kx, y + (-2) * ky + o, kx, ky, color);
-		GFX_fillRect(x + 5 * kx, y + (-2) * ky + o, kx, ky, color);
-		GFX_fillRect(x + 5 * kx, y + (-3) * ky + o, kx, ky, color);
-		GFX_fillRect(x + 6 * kx, y + (-3) * ky + o, kx, ky, color);
-		GFX_fillRect(x + 7 * kx, y + (-4) * ky + o, kx, ky, color);
-		GFX_fillRect(x + 6 * kx, y + (-4) * ky + o, kx, ky, color);
+		// Send this buffer in the background and go on drawing into the other one.
+		// The driver waits for the previous transfer before starting this one, so
+		// the other buffer is free by now.
+		uint8_t *sent = fb.buffer;
+		sendBitmap(fb.x, fb.y, fb.width, fb.height, sent);
+		fb.buffer = backFramebuffer;
+		backFramebuffer = sent;
+	}
+	else if (fb.buffer != NULL)
+	{
+		sendBitmap(fb.x, fb.y, fb.width, fb.height, fb.buffer);
+		LCD_waitForWrite();
 	}
 }
 
-void GFX_drawChar(int16_t x, int16_t y, unsigned char c, struct Color color,
-				  struct Color bg, uint8_t size_x, uint8_t size_y)
+#if defined(USE_DISPLAY_LIST) || defined(USE_RENDER_QUEUE)
+static void replayCommand(const struct GFX_Command *cmd)
 {
-	if (!gfxFont)
+	const int16_t *a = cmd->a;
+	switch (cmd->op)
 	{
-		if ((x >= _width) ||			  // Clip right
-			(y >= _height) ||			  // Clip bottom
-			((x + 6 * size_x - 1) < 0) || // Clip left
-			((y + 8 * size_y - 1) < 0))	  // Clip top
-			return;
-
-		DIACRITIC diacritic = DIACRITIC_NONE;
-		if( c >= 128)
-		{
-			wchar_t wc = wideCharacters[(uint8_t)c - 128];
-			c = solveDiacritic(wc, &diacritic);
-		}
-		
-		if (c >= 176)
-			c++; // Handle 'classic' charset behavior
+	case OP_PIXEL:
+		GFX_drawPixel(a[0], a[1], cmd->color);
+		break;
+	case OP_LINE:
+		GFX_drawLine(a[0], a[1], a[2], a[3], cmd->color);
+		break;
+	case OP_VLINE:
+		GFX_drawFastVLine(a[0], a[1], a[2], cmd->color);
+		break;
+	case OP_HLINE:
+		GFX_drawFastHLine(a[0], a[1], a[2], cmd->color);
+		break;
+	case OP_RECT:
+		GFX_drawRect(a[0], a[1], a[2], a[3], cmd->color);
+		break;
+	case OP_FILL_RECT:
+		GFX_fillRect(a[0], a[1], a[2], a[3], cmd->color);
+		break;
+	case OP_FILL_ROUNDED_RECT:
+		GFX_fillRoundedRect(a[0], a[1], a[2], a[3], a[4], cmd->color);
+		break;
+	case OP_TRIANGLE:
+		GFX_drawTriangle(a[0], a[1], a[2], a[3], a[4], a[5], cmd->color);
+		break;
+	case OP_FILL_TRIANGLE:
+		GFX_fillTriangle(a[0], a[1], a[2], a[3], a[4], a[5], cmd->color);
+		break;
+	case OP_CIRCLE:
+		GFX_drawCircle(a[0], a[1], a[2], cmd->color);
+		break;
+	case OP_FILL_CIRCLE:
+		GFX_fillCircle(a[0], a[1], a[2], cmd->color);
+		break;
+	case OP_CHAR:
+		beginDraw();
+		drawChar(a[0], a[1], cmd->c, cmd->color, cmd->bg, cmd->size_x, cmd->size_y, cmd->font);
+		endDraw();
+		break;
+	case OP_BITMAP:
+		GFX_drawBitmapScaled(a[0], a[1], cmd->bitmap, a[2], a[3], cmd->color, cmd->bg, cmd->size_x, cmd->size_y);
+		break;
+	case OP_CLEAR_COLOR:
+		GFX_setClearColor(cmd->color);
+		break;
+	case OP_CREATE_FRAMEBUF:
+		GFX_createFramebuf(a[0], a[1], a[2], a[3]);
+		break;
+	case OP_CREATE_DOUBLE_FRAMEBUF:
+		GFX_createDoubleFramebuf(a[0], a[1], a[2], a[3]);
+		break;
+	case OP_MOVE_FRAMEBUF:
+		GFX_moveFramebuf(a[0], a[1]);
+		break;
+	case OP_DESTROY_FRAMEBUF:
+		GFX_destroyFramebuf();
+		break;
+	case OP_SET_FORMAT:
+		GFX_setFramebufFormat(cmd->c);
+		break;
+#ifdef USE_INDEXED_FRAMEBUF
+	case OP_SET_PALETTE_COLOR:
+		GFX_setPaletteColor(cmd->c, cmd->color);
+		break;
+#endif
+#ifdef USE_SCROLL_CONSOLE
+	case OP_SCROLL_AREA:
+		setScrollArea(a[0], a[1]);
+		break;
+	case OP_SCROLL_START:
+		setScrollStart(a[0]);
+		break;
+#endif
+	case OP_SET_CLIP:
+		GFX_setClip(a[0], a[1], a[2], a[3]);
+		break;
+	case OP_PARTIAL_ROWS:
+		setPartialRows(a[0], a[1]);
+		break;
+	case OP_FLUSH:
+		GFX_flush();
+		break;
+#ifdef USE_DISPLAY_LIST
+	case OP_BEGIN_FRAME:
+		GFX_beginFrame();
+		break;
+	case OP_END_FRAME:
+		GFX_endFrame();
+		break;
+#endif
+#ifdef USE_DIRTY_RECTS
+	case OP_FLUSH_DIRTY:
+		GFX_flushDirty();
+		break;
+#endif
+	}
+}
+#endif
 
-		// GFX_Select();
-		for (int8_t i = 0; i < 5; i++)
-		{ // Char bitmap = 5 columns
-			uint8_t line = font[c * 5 + i];
-			for (int8_t j = 0; j < 8; j++, line >>= 1)
-			{
-				if (line & 1)
-				{
-					if (size_x == 1 && size_y == 1)
-						GFX_drawPixel(x + i, y + j, color);
-					else
-						GFX_fillRect(x + i * size_x, y + j * size_y, size_x,
-									 size_y, color);
-				}
-				else if (isNotEqual(bg,color))
-				{
-					if (size_x == 1 && size_y == 1)
-						GFX_drawPixel(x + i, y + j, bg);
-					else
-						GFX_fillRect(x + i * size_x, y + j * size_y, size_x,
-									 size_y, bg);
-				}
-			}
-		}
-		drawDiacritic(x, y, c, diacritic, color, bg, size_x, size_y);
+#ifdef USE_DISPLAY_LIST
 
-		if (isNotEqual(bg,color))
-		{ // If opaque, draw vertical line for last column
-			if (size_x == 1 && size_y == 1)
-				GFX_drawFastVLine(x + 5, y, 8, bg);
-			else
-				GFX_fillRect(x + 5 * size_x, y, size_x, 8 * size_y, bg);
-		}
-		// GFX_DeSelect();
-	}
-	else
+// Draws the recorded calls that touch a band of an area into buffer, starting
+// from the clear colour. Nothing is drawn outside of the band.
+static void renderBand(uint8_t *buffer, uint16_t x, uint16_t y, uint16_t width, uint16_t height)
+{
+	struct RenderTarget *t = &fb;
+	t->buffer = buffer;
+	t->x = x;
+	t->y = y;
+	t->width = width;
+	t->height = height;
+	t->clip = true;
+	t->format = GFX_FORMAT_RGB666;
+	fillArea(x, y, width, height, clearColour);
+	for (uint16_t i = 0; i < displayListLength; i++)
 	{
-		c -= (uint8_t)gfxFont->first;
-		GFXglyph *glyph = (gfxFont->glyph) + c;
-		uint8_t *bitmap = gfxFont->bitmap;
+		const struct GFX_Command *cmd = &displayList[i];
+		if (cmd->y1 >= (int16_t)y && cmd->y0 < (int16_t)(y + height) && cmd->x1 >= (int16_t)x &&
+			cmd->x0 < (int16_t)(x + width))
+			replayCommand(cmd);
+	}
+	t->clip = false;
+}
 
-		uint16_t bo = glyph->bitmapOffset;
-		uint8_t w = glyph->width, h = glyph->height;
-		int8_t xo = glyph->xOffset, yo = glyph->yOffset;
-		uint8_t xx, yy, bits = 0, bit = 0;
-		int16_t xo16 = 0, yo16 = 0;
+#ifdef USE_PARALLEL_BANDS
+#define PARALLEL_BAND_BUFFERS 4 ///< Two per core, so drawing and sending overlap
 
-		if (size_x > 1 || size_y > 1)
-		{
-			xo16 = xo;
-			yo16 = yo;
-		}
+#define BAND_WORKER_QUIT 0 ///< FIFO word ending the band worker, any other is the band height of a frame
 
-		// GFX_Select();
-		for (yy = 0; yy < h; yy++)
+static uint8_t rasterCores = 2;
+static uint8_t *parallelBands[PARALLEL_BAND_BUFFERS];
+static volatile uint16_t bandsDrawnByCore1 = 0; ///< Index of the last band core 1 finished, plus one
+static volatile uint16_t bandsSent = 0;		   ///< Bands before this one are sent, their buffers are free
+static bool bandWorkerRunning = false;
+
+// Stays on core 1 from the first parallel frame on. Each frame, core 0 sends
+// it the band height through the FIFO. Core 1 draws the odd bands, core 0 the
+// even ones and sends them all in order.
+static void bandWorker()
+{
+	uint32_t word;
+	while ((word = multicore_fifo_pop_blocking()) != BAND_WORKER_QUIT)
+	{
+		__mem_fence_acquire();
+		const uint16_t bandHeight = word, width = _width, height = _height;
+		for (uint16_t k = 1; k * bandHeight < height; k += 2)
 		{
-			for (xx = 0; xx < w; xx++)
-			{
-				if (!(bit++ & 7))
-				{
-					bits = bitmap[bo++];
-				}
-				if (bits & 0x80)
-				{
-					if (size_x == 1 && size_y == 1)
-					{
-						GFX_drawPixel(x + xo + xx, y + yo + yy, color);
-					}
-					else
-					{
-						GFX_fillRect(x + (xo16 + xx) * size_x,
-									 y + (yo16 + yy) * size_y, size_x, size_y,
-									 color);
-					}
-				}
-				bits <<= 1;
-			}
+			// The buffer was last used by band k - 4
+			while (bandsSent + PARALLEL_BAND_BUFFERS - 1 < k)
+				tight_loop_contents();
+			__mem_fence_acquire();
+			uint16_t y = k * bandHeight;
+			renderBand(parallelBands[k % PARALLEL_BAND_BUFFERS], 0, y, width,
+					   height - y < bandHeight ? height - y : bandHeight);
+			__mem_fence_release();
+			bandsDrawnByCore1 = k + 1;
 		}
-		// GFX_DeSelect();
+		fb.buffer = NULL;
 	}
+	multicore_fifo_push_blocking(BAND_WORKER_QUIT); // Core 1 is free again
 }
 
-void GFX_write(uint8_t c, uint8_t textsize)
+// Gives core 1 back, for the render core or anything else
+static void stopBandWorker()
 {
-	uint8_t textsize_y = textsize;
-	uint8_t textsize_x = textsize;
-	if (!gfxFont)
+	if (!bandWorkerRunning)
+		return;
+	multicore_fifo_push_blocking(BAND_WORKER_QUIT);
+	multicore_fifo_pop_blocking();
+	bandWorkerRunning = false;
+}
+
+void GFX_setRasterCores(uint8_t cores)
+{
+	rasterCores = cores > 1 ? 2 : 1;
+	if (rasterCores == 1)
+		stopBandWorker();
+}
+
+// Both cores draw bands, returns false when there wasn't memory for it
+static bool renderParallel()
+{
+	uint16_t bandHeight = DISPLAY_LIST_BAND_SIZE / PARALLEL_BAND_BUFFERS / (_width * 3);
+	if (bandHeight == 0)
+		return false;
+	bool wholeTiles = true; ///< Bands are sent through the tile hashes
+#ifdef USE_TILE_HASH
+	// Bands of whole tile rows keep the tile hashes. Shorter bands would split
+	// tiles, which never match, so they are sent whole without hashing.
+	wholeTiles = bandHeight >= TILE_SIZE;
+	if (wholeTiles)
+		bandHeight -= bandHeight % TILE_SIZE;
+#endif
+	if (bandHeight > _height)
+		bandHeight = _height;
+	uint8_t got = 0;
+	while (got < PARALLEL_BAND_BUFFERS && (parallelBands[got] = framebufAcquire(_width * bandHeight * 3)) != NULL)
+		got++;
+	if (got < PARALLEL_BAND_BUFFERS)
 	{
-		if (c == '\n')
-		{								// Newline?
-			cursor_x = 0;				// Reset x to zero,
-			cursor_y += textsize_y * 8; // advance y one line
-		}
-		else if (c != '\r')
-		{ // Ignore carriage returns
-			if (wrap && ((cursor_x + textsize_x * 6) > _width))
-			{								// Off right?
-				cursor_x = 0;				// Reset x to zero,
-				cursor_y += textsize_y * 8; // advance y one line
-			}
-			GFX_drawChar(cursor_x, cursor_y, c, textcolor, textbgcolor,
-						 textsize_x, textsize_y);
-			cursor_x += textsize_x * 6; // Advance x one char
-		}
+		while (got > 0)
+			framebufRelease(parallelBands[--got], _width * bandHeight * 3);
+		return false;
 	}
-	else
+
+#ifdef USE_TILE_HASH
+	if (!wholeTiles)
+		forgetTiles(0, 0, _width, _height);
+#endif
+	bandsDrawnByCore1 = 0;
+	bandsSent = 0;
+	if (!bandWorkerRunning)
 	{
-		if (c == '\n')
+		multicore_reset_core1();
+		multicore_launch_core1(bandWorker);
+		bandWorkerRunning = true;
+	}
+	__mem_fence_release();
+	multicore_fifo_push_blocking(bandHeight);
+
+	uint16_t k = 0;
+	for (uint16_t y = 0; y < _height; y += bandHeight, k++)
+	{
+		uint16_t height = _height - y < bandHeight ? _height - y : bandHeight;
+		uint8_t *buffer = parallelBands[k % PARALLEL_BAND_BUFFERS];
+		if (k % 2 == 0)
 		{
-			cursor_x = 0;
-			cursor_y += (int16_t)textsize_y * (uint8_t)(gfxFont->yAdvance);
+			// Starting band k - 1 waited for band k - 2, so band k - 4 is long sent
+			renderBand(buffer, 0, y, _width, height);
 		}
-		else if (c != '\r')
+		else
 		{
-			uint8_t first = gfxFont->first;
-			if ((c >= first) && (c <= (uint8_t)gfxFont->last))
-			{
-				GFXglyph *glyph = (gfxFont->glyph) + (c - first);
-				uint8_t w = glyph->width, h = glyph->height;
-				if ((w > 0) && (h > 0))
-				{										 // Is there an associated bitmap?
-					int16_t xo = (int8_t)glyph->xOffset; // sic
-					if (wrap && ((cursor_x + textsize_x * (xo + w)) > _width))
-					{
-						cursor_x = 0;
-						cursor_y += (int16_t)textsize_y * (uint8_t)gfxFont->yAdvance;
-					}
-					GFX_drawChar(cursor_x, cursor_y, c, textcolor,
-								 textbgcolor, textsize_x, textsize_y);
-				}
-				cursor_x += (uint8_t)glyph->xAdvance * (int16_t)textsize_x;
-			}
+			while (bandsDrawnByCore1 <= k)
+				tight_loop_contents();
+			__mem_fence_acquire();
 		}
+		// Band k - 1 is done before band k goes out, whatever sendBitmap
+		// leaves out, so every buffer before this one may be drawn again
+		LCD_waitForWrite();
+		if (wholeTiles)
+			sendBitmap(0, y, _width, height, buffer);
+		else
+			LCD_WriteBitmapAsync(0, y, _width, height, buffer);
+		__mem_fence_release();
+		bandsSent = k;
 	}
-}
+	LCD_waitForWrite();
+	bandsSent = k;
 
-void GFX_setCursor(int16_t x, int16_t y)
-{
-	cursor_x = x;
-	cursor_y = y;
+	for (uint8_t i = PARALLEL_BAND_BUFFERS; i > 0; i--)
+		framebufRelease(parallelBands[i - 1], _width * bandHeight * 3);
+	return true;
 }
+#endif
 
-void GFX_setTextColor(struct Color color)
+// Replays the display list into an area one band of rows at a time and sends
+// every band with one LCD_WriteBitmap. Returns false when not even one row of
+// the area fits in memory.
+static bool renderArea(uint16_t x, uint16_t y, uint16_t width, uint16_t height)
 {
-	textcolor = color;
+#ifdef USE_DMA
+	// Two bands, one is drawn while the other one is sent
+	const uint8_t bandCount = 2;
+#else
+	const uint8_t bandCount = 1;
+#endif
+	uint16_t bandHeight = DISPLAY_LIST_BAND_SIZE / bandCount / (width * 3);
+#ifdef USE_TILE_HASH
+	// Bands of whole tile rows, a tile split over two bands would never match its hash
+	if (bandHeight > TILE_SIZE)
+		bandHeight -= bandHeight % TILE_SIZE;
+#endif
+	if (bandHeight > height)
+		bandHeight = height;
+	uint8_t *bands[2] = {NULL, NULL};
+	while (bandHeight > 0 && (bands[0] = framebufAcquire(width * bandHeight * 3)) == NULL)
+		bandHeight /= 2;
+	if (bands[0] == NULL)
+		return false;
+	if (bandCount > 1)
+		bands[1] = framebufAcquire(width * bandHeight * 3);
+
+	uint8_t next = 0;
+	for (uint16_t row = y; row < y + height; row += bandHeight)
+	{
+		// A transfer only starts once the previous one is done, so the band
+		// that last used this buffer, two bands back, has been sent already.
+		// With a single buffer the band before is still being read from it.
+		uint8_t *buffer = bands[next];
+		if (bands[1] != NULL)
+			next ^= 1;
+		else
+			LCD_waitForWrite();
+		uint16_t rows = y + height - row < bandHeight ? y + height - row : bandHeight;
+		renderBand(buffer, x, row, width, rows);
+		sendBitmap(x, row, width, rows, buffer);
+	}
+	LCD_waitForWrite();
+	framebufRelease(bands[0], width * bandHeight * 3);
+	framebufRelease(bands[1], width * bandHeight * 3);
+	return true;
 }
 
-void GFX_setTextBack(struct Color color)
+// Draws the whole display list, band by band
+static void renderDisplayList()
 {
-	textbgcolor = color;
+	recording = false;
+
+	// Only the clip area is drawn and sent
+	int16_t x0 = clipX0 > 0 ? clipX0 : 0;
+	int16_t y0 = clipY0 > 0 ? clipY0 : 0;
+	int16_t x1 = clipX1 < (int16_t)_width ? clipX1 : (int16_t)_width;
+	int16_t y1 = clipY1 < (int16_t)_height ? clipY1 : (int16_t)_height;
+	bool whole = x0 == 0 && y0 == 0 && x1 == (int16_t)_width && y1 == (int16_t)_height;
+
+	struct RenderTarget saved = fb;
+	LCD_beginWrite();
+
+	bool drawn = x0 >= x1 || y0 >= y1;
+#ifdef USE_PARALLEL_BANDS
+	bool parallel = rasterCores > 1 && get_core_num() == 0 && whole;
+#ifdef USE_RENDER_QUEUE
+	parallel = parallel && !renderCoreRunning;
+#endif
+	drawn = drawn || (parallel && renderParallel());
+#endif
+	(void)whole;
+	if (!drawn && !renderArea(x0, y0, x1 - x0, y1 - y0))
+	{
+		// No room for even a single row, draw it straight to the screen
+		fb.buffer = NULL;
+		fillArea(0, 0, _width, _height, clearColour);
+		for (uint16_t i = 0; i < displayListLength; i++)
+			replayCommand(&displayList[i]);
+	}
+	LCD_endWrite();
+
+	fb = saved;
+	rememberFrame();
+	displayListLength = 0;
 }
 
-void GFX_setFont(const GFXfont *f)
+void GFX_beginFrame()
 {
-	if (f)
-	{ // Font struct pointer passed in?
-		if (!gfxFont)
-		{ // And no current font struct?
-			// Switching from classic to new font behavior.
-			// Move cursor pos down 6 pixels so it's on baseline.
-			cursor_y += 6;
-		}
-	}
-	else if (gfxFont)
-	{ // NULL passed.  Current font struct defined?
-		// Switching from new to classic font behavior.
-		// Move cursor pos up 6 pixels so it's at top-left of char.
-		cursor_y -= 6;
-	}
-	gfxFont = (GFXfont *)f;
+	GFX_POST(.op = OP_BEGIN_FRAME);
+	displayListLength = 0;
+	displayListOverflow = false;
+	recording = true;
 }
 
-void GFX_fillCircle(int16_t x0, int16_t y0, int16_t r,
-					struct Color color)
+bool GFX_endFrame()
 {
-
-	GFX_drawFastVLine(x0, y0 - r, 2 * r + 1, color);
-	fillCircleHelper(x0, y0, r, 3, 0, color);
+	if (captureCommand((struct GFX_Command){.op = OP_END_FRAME}, false))
+	{
+		return true; // The render core draws the frame later
+	}
+	if (recording)
+		renderDisplayList();
+	return !displayListOverflow;
 }
 
-void GFX_drawCircle(int16_t x0, int16_t y0, int16_t r, struct Color color)
+#ifdef USE_DIRTY_RECTS
+bool GFX_flushDirty()
 {
+	if (captureCommand((struct GFX_Command){.op = OP_FLUSH_DIRTY}, false))
+	{
+		return true;
+	}
+	if (!recording)
+		return !displayListOverflow;
+	if (!lastFrameShown || lastFrameWidth != _width || lastFrameHeight != _height ||
+		lastFrameRotation != LCD_getRotation() || lastFrameColorMode != LCD_getColorMode() ||
+		isNotEqual(lastFrameClear, clearColour) || lastFrameClip[0] != clipX0 || lastFrameClip[1] != clipY0 ||
+		lastFrameClip[2] != clipX1 || lastFrameClip[3] != clipY1)
+	{
+		// Nothing to compare with, send it all
+		renderDisplayList();
+		return true;
+	}
 
-	int16_t f = 1 - r;
-	int16_t ddF_x = 1;
-	int16_t ddF_y = -2 * r;
-	int16_t x = 0;
-	int16_t y = r;
-
-	GFX_drawPixel(x0, y0 + r, color);
-	GFX_drawPixel(x0, y0 - r, color);
-	GFX_drawPixel(x0 + r, y0, color);
-	GFX_drawPixel(x0 - r, y0, color);
+	recording = false;
+	dirtyCount = 0;
+	diffFrames();
 
-	while (x < y)
+	struct RenderTarget saved = fb;
+	LCD_beginWrite();
+	bool drawn = true;
+	for (uint8_t i = 0; i < dirtyCount && drawn; i++)
 	{
-		if (f >= 0)
-		{
-			y--;
-			ddF_y += 2;
-			f += ddF_y;
-		}
-		x++;
-		ddF_x += 2;
-		f += ddF_x;
+		const struct DirtyRect *r = &dirtyRects[i];
+		// Inside of the clip area, the only part of the screen frames are drawn to
+		int16_t x0 = r->x0 > clipX0 ? r->x0 : clipX0;
+		int16_t y0 = r->y0 > clipY0 ? r->y0 : clipY0;
+		int16_t x1 = r->x1 < clipX1 - 1 ? r->x1 : clipX1 - 1;
+		int16_t y1 = r->y1 < clipY1 - 1 ? r->y1 : clipY1 - 1;
+		if (x0 <= x1 && y0 <= y1)
+			drawn = renderArea(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+	}
+	LCD_endWrite();
+	fb = saved;
 
-		GFX_drawPixel(x0 + x, y0 + y, color);
-		GFX_drawPixel(x0 - x, y0 + y, color);
-		GFX_drawPixel(x0 + x, y0 - y, color);
-		GFX_drawPixel(x0 - x, y0 - y, color);
-		GFX_drawPixel(x0 + y, y0 + x, color);
-		GFX_drawPixel(x0 - y, y0 + x, color);
-		GFX_drawPixel(x0 + y, y0 - x, color);
-		GFX_drawPixel(x0 - y, y0 - x, color);
+	if (!drawn)
+	{
+		renderDisplayList();
+		return true;
 	}
+	rememberFrame();
+	displayListLength = 0;
+	return true;
 }
+#endif
+#endif
 
-char printBuf[100];
-void printString(char s[], uint8_t textsize)
+#ifdef USE_RENDER_QUEUE
+// Takes commands from the queue and draws them. Each command counts as done
+// once it is drawn, so fences complete while more work keeps coming. The
+// display stays selected while there is work.
+static void renderCoreLoop()
 {
-	uint8_t n = strlen(s);
-	for (int i = 0; i < n; i++)
-		GFX_write(s[i], textsize);
+	bool busy = false;
+	while (true)
+	{
+		uint32_t tail = queueTail;
+		if (tail == queueHead)
+		{
+			if (busy)
+			{
+				LCD_endWrite();
+				LCD_waitForWrite();
+				busy = false;
+			}
+			tight_loop_contents();
+			continue;
+		}
+		if (!busy)
+		{
+			LCD_beginWrite();
+			busy = true;
+		}
+		__mem_fence_acquire();
+		const struct GFX_Command *cmd = &renderQueue[tail % RENDER_QUEUE_SIZE];
+		if (cmd->op == OP_STOP_RENDER_CORE)
+		{
+			LCD_endWrite();
+			LCD_waitForWrite();
+			__mem_fence_release();
+			queueTail = queueDone = tail + 1;
+			return;
+		}
+		replayCommand(cmd);
+		__mem_fence_release(); // Done with the slot before the producer may reuse it
+		queueTail = queueDone = tail + 1;
+	}
 }
 
-void GFX_printf(uint8_t textsize, const char *format, ...)
+void GFX_startRenderCore()
 {
-	va_list args;
-	va_start(args, format);
-	vsprintf(printBuf, format, args);
-	printString(printBuf, textsize);
-	va_end(args);
+	if (renderCoreRunning)
+	{
+		return;
+	}
+#ifdef USE_PARALLEL_BANDS
+	stopBandWorker(); // Core 1 becomes the render core
+#endif
+	queueHead = queueTail = queueDone = 0;
+	// The framebuffer goes with the drawing to the render core
+	renderTarget[RENDER_CORE] = renderTarget[0];
+	renderTarget[0] = (struct RenderTarget){NULL};
+	__mem_fence_release();
+	multicore_reset_core1();
+	multicore_launch_core1(renderCoreLoop);
+	renderCoreRunning = true;
 }
 
-void GFX_createFramebuf(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+void GFX_stopRenderCore()
 {
-	if(w * h * 3 > BUFFER_MAX_SIZE) //e.g. 200p x 200p square
+	if (!renderCoreRunning || get_core_num() == RENDER_CORE)
 	{
 		return;
 	}
-	frameBufferX = x;
-	frameBufferY = y;
-	frameBufferWidth = w;
-	frameBufferHeight = h;
-	gfxFramebuffer = malloc(w * h * sizeof(uint8_t) * 3);
+	postCommand(&(struct GFX_Command){.op = OP_STOP_RENDER_CORE});
+	GFX_waitFence(GFX_fence());
+	renderTarget[0] = renderTarget[RENDER_CORE];
+	renderTarget[RENDER_CORE] = (struct RenderTarget){NULL};
+	renderCoreRunning = false;
 }
 
-bool hasFrameBuffer()
+uint32_t GFX_fence()
 {
-	return gfxFramebuffer != NULL;
+	return queueHead;
 }
-void GFX_destroyFramebuf()
+
+bool GFX_fenceDone(uint32_t fence)
 {
-	frameBufferX = 0;
-	frameBufferY = 0;
-	frameBufferWidth = 0;
-	frameBufferHeight = 0;
-	free(gfxFramebuffer);
-	gfxFramebuffer = NULL;
+	bool done = !renderCoreRunning || (int32_t)(queueDone - fence) >= 0;
+	__mem_fence_acquire();
+	return done;
 }
-void GFX_flush()
+
+void GFX_waitFence(uint32_t fence)
 {
-	if (gfxFramebuffer != NULL)
-	{
-		LCD_WriteBitmap(frameBufferX, frameBufferY, frameBufferWidth, frameBufferHeight, gfxFramebuffer);
-	}
+	while (!GFX_fenceDone(fence))
+		tight_loop_contents();
 }
+#endif
 
 void initGfxDmaChan()
 {
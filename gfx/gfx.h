@@ -11,11 +11,138 @@ extern "C" {
 
 #define BUFFER_MAX_SIZE 120000 //120 kB 
 
+//#define USE_INDEXED_FRAMEBUF 1 // 8-bit framebuffers with a palette, see GFX_setFramebufFormat
+#define INDEXED_BUFFER_MAX_SIZE (480 * 320) ///< An indexed framebuffer may cover the whole screen
+
+//#define USE_RGB565_FRAMEBUF 1 // 16-bit framebuffers, see GFX_setFramebufFormat
+
+//#define USE_RGB111_FRAMEBUF 1 // 3-bit framebuffers, two pixels per byte, see GFX_setFramebufFormat
+
+#ifndef FLUSH_LINE_SIZE
+#define FLUSH_LINE_SIZE (480 * 3) ///< Bytes of each of the two buffers other formats are converted into when flushed, and scaled bitmaps expanded into
+#endif
+
+//#define USE_FRAMEBUFFER_ARENA 1 // Framebuffers come from a static arena instead of malloc
+//Buffers may be released in any order, neighbouring free space is merged. A buffer still needs one gap it fits in.
+#ifndef FRAMEBUFFER_ARENA_SIZE
+#ifdef USE_INDEXED_FRAMEBUF
+#define FRAMEBUFFER_ARENA_SIZE INDEXED_BUFFER_MAX_SIZE ///< Bytes reserved for the arena
+#else
+#define FRAMEBUFFER_ARENA_SIZE BUFFER_MAX_SIZE ///< Bytes reserved for the arena
+#endif
+#endif
+#ifndef FRAMEBUFFER_ARENA_BLOCKS
+#define FRAMEBUFFER_ARENA_BLOCKS 4 ///< Buffers the arena can hand out at once
+#endif
+
+//#define USE_TILE_HASH 1 // Sent bitmaps leave out the tiles that are the same as what was last sent there
+#ifndef TILE_SIZE
+#define TILE_SIZE 32 ///< Side of a tile in pixels
+#endif
+
+//#define USE_DISPLAY_LIST 1 // Record whole frames and draw them in bands, see GFX_beginFrame
+#ifndef DISPLAY_LIST_SIZE
+#define DISPLAY_LIST_SIZE 256 ///< GFX_* calls one frame can record
+#endif
+#ifndef DISPLAY_LIST_BAND_SIZE
+#define DISPLAY_LIST_BAND_SIZE BUFFER_MAX_SIZE ///< Bytes of the band a frame is drawn into
+#endif
+
+//#define USE_DIRTY_RECTS 1 // GFX_flushDirty only sends what changed since the last frame, needs USE_DISPLAY_LIST
+#ifndef DIRTY_RECT_COUNT
+#define DIRTY_RECT_COUNT 8 ///< Separate areas GFX_flushDirty sends at most
+#endif
+#ifndef DIRTY_RECT_WASTE
+#define DIRTY_RECT_WASTE 512 ///< Unchanged pixels a merge of two areas may add
+#endif
+
+//#define USE_PARALLEL_BANDS 1 // Both cores draw the bands of a frame, needs USE_DISPLAY_LIST
+
+//#define USE_RENDER_QUEUE 1 // Let core 1 draw and drive the display, see GFX_startRenderCore
+#ifndef RENDER_QUEUE_SIZE
+#define RENDER_QUEUE_SIZE 64 ///< GFX_* calls core 0 can post before it has to wait
+#endif
+
+//#define USE_SCROLL_CONSOLE 1 // GFX_write scrolls text with the display's vertical scrolling, see GFX_startConsole
+
+#ifndef GFX_PRINTF_SIZE
+#define GFX_PRINTF_SIZE 128 ///< Bytes of the buffer GFX_printf formats into, with the terminating 0
+#endif
+
+//#define USE_TEXT_RUNS 1 // GFX_printf sends what it writes on one line as a single strip, see GFX_printf
+
+//#define USE_GLYPH_CACHE 1 // Opaque built-in font glyphs drawn to the display are kept rendered, see GFX_drawChar
+#ifndef GLYPH_CACHE_ENTRIES
+#define GLYPH_CACHE_ENTRIES 16 ///< Glyphs the cache keeps, the least recently drawn one makes room
+#endif
+#ifndef GLYPH_CACHE_CELL_SIZE
+#define GLYPH_CACHE_CELL_SIZE (6 * 2 * 8 * 2 * 3) ///< Bytes of one cached glyph, enough for textsize 2
+#endif
+
+/// How framebuffers store their pixels
+enum GFX_PixelFormat
+{
+	GFX_FORMAT_RGB666,	 ///< 3 bytes per pixel, as they are sent
+	GFX_FORMAT_INDEXED8, ///< 1 byte per pixel, an index into the palette, needs USE_INDEXED_FRAMEBUF
+	GFX_FORMAT_RGB565,	 ///< 2 bytes per pixel, needs USE_RGB565_FRAMEBUF
+	GFX_FORMAT_RGB111,	 ///< 2 pixels per byte, one bit per channel as in LCD_COLOR3, needs USE_RGB111_FRAMEBUF
+};
+
 //There can be anything in the memory after initialization, so make it sure that all buffer is used or you risk random pixels
 void GFX_createFramebuf(uint16_t x, uint16_t y, uint16_t w, uint16_t h);
 void GFX_destroyFramebuf();
 void GFX_flush();
+//Two buffers of w x h: GFX_flush starts sending one and drawing goes on in the other, which holds what was flushed before
+void GFX_createDoubleFramebuf(uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+void GFX_moveFramebuf(uint16_t x, uint16_t y);
 bool hasFrameBuffer();
+//Format of the framebuffers created from now on, GFX_FORMAT_RGB666 by default
+//Framebuffers of other formats are at most FLUSH_LINE_SIZE / 3 pixels wide, wider ones are not created
+void GFX_setFramebufFormat(enum GFX_PixelFormat format);
+
+#ifdef USE_INDEXED_FRAMEBUF
+//Indexed framebuffers keep an index into a palette of 256 colours, RGB332 (index RRRGGGBB) by default.
+//Colours drawn into them are mapped to the closest palette entry, GFX_flush sends the palette colours.
+void GFX_setPaletteColor(uint8_t index, struct Color color);
+void GFX_setPalette(const struct Color *colors, uint16_t count);
+struct Color GFX_getPaletteColor(uint8_t index);
+#endif
+uint32_t GFX_getFramebufHighWater();
+void GFX_resetFramebufHighWater();
+
+#ifdef USE_DISPLAY_LIST
+//Calls between these two are recorded, GFX_endFrame then draws the whole screen band by band
+//Returns false when the frame didn't fit in the display list, what didn't fit was drawn directly
+void GFX_beginFrame();
+bool GFX_endFrame();
+#endif
+
+#ifdef USE_DIRTY_RECTS
+//Ends a frame like GFX_endFrame, but only draws and sends the areas where it differs from the last frame
+//The screen must still show the last frame, anything drawn outside of a frame makes the next one whole
+bool GFX_flushDirty();
+#endif
+
+#ifdef USE_PARALLEL_BANDS
+//1 or 2 cores draw the bands of a frame, 2 by default. The first frame drawn by 2 cores launches a band worker that
+//stays on core 1 and is woken through the FIFO, GFX_setRasterCores(1) and GFX_startRenderCore give core 1 back.
+//With USE_TILE_HASH, bands are whole tile rows only when DISPLAY_LIST_BAND_SIZE holds four of them
+//(4 * TILE_SIZE * width * 3 bytes), otherwise frames drawn by 2 cores are sent whole without tile hashing.
+void GFX_setRasterCores(uint8_t cores);
+#endif
+
+#ifdef USE_RENDER_QUEUE
+//Starts core 1 as the render core. From then on, GFX_* calls made on core 0 are queued and return at once,
+//core 1 draws them in order and is the only one to touch the display
+void GFX_startRenderCore();
+//Waits until core 1 has drawn everything and stops it, GFX_* calls are drawn directly again
+void GFX_stopRenderCore();
+//Returns a fence for everything posted so far, it is done once core 1 has drawn all of it.
+//The last transfer to the display may still be going on, but nothing posted is read any more.
+uint32_t GFX_fence();
+bool GFX_fenceDone(uint32_t fence);
+void GFX_waitFence(uint32_t fence);
+#endif
 
 void GFX_drawPixel(int16_t x, int16_t y, struct Color color);
 
@@ -24,11 +151,26 @@ char getCharForWideChar(wchar_t wc);
 
 void GFX_drawChar(int16_t x, int16_t y, unsigned char c, struct Color color, struct Color bg, uint8_t size_x, uint8_t size_y);
 void GFX_write(uint8_t c, uint8_t textsize);
+//Draws a 1bpp bitmap, rows padded to whole bytes and the first pixel in the top bit, each pixel size_x by size_y
+//pixels large. Set bits are drawn in color, the others in bg unless it is the same colour. Straight to the display,
+//an opaque bitmap is sent in one window. Recorded in frames by its pointer, the bitmap has to stay unchanged until drawn.
+void GFX_drawBitmapScaled(int16_t x, int16_t y, const uint8_t *bitmap, uint16_t w, uint16_t h, struct Color color,
+						  struct Color bg, uint8_t size_x, uint8_t size_y);
 void GFX_setCursor(int16_t x, int16_t y);
 void GFX_setTextColor(struct Color color);
 void GFX_setTextBack(struct Color color);
 void GFX_setFont(const GFXfont *f);
 
+#ifdef USE_SCROLL_CONSOLE
+//Text written with the built-in font in textsize between rows top and GFX_getHeight() - bottom scrolls in hardware: past the last
+//line the display moves its scroll start one line on and only the line coming in is cleared and drawn.
+//The area is rounded down to whole lines of textsize, the rest goes to the bottom. Only in rotation 0, returns false otherwise.
+//The area is cleared and the cursor put on its first line. Not for use between GFX_beginFrame and GFX_endFrame.
+bool GFX_startConsole(uint16_t top, uint16_t bottom, uint8_t textsize);
+//Turns scrolling off, the console area shows its lines in memory order again and should be redrawn
+void GFX_stopConsole();
+#endif
+
 void GFX_drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, struct Color color);
 void GFX_drawFastVLine(int16_t x, int16_t y, int16_t h, struct Color color);
 void GFX_drawFastHLine(int16_t x, int16_t y, int16_t l, struct Color color);
@@ -38,6 +180,16 @@ void GFX_fillRect(int16_t x, int16_t y, int16_t w, int16_t h, struct Color color
 void GFX_fillRoundedRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t r, struct Color color);
 
 void GFX_fillScreen(struct Color color);
+
+//Drawing is limited to the area x, y, w, h until GFX_resetClip. Frames only draw and send that area,
+//framebuffers are still sent whole. A frame is drawn with the clip set when it ends.
+void GFX_setClip(int16_t x, int16_t y, int16_t w, int16_t h);
+void GFX_resetClip();
+//Partial mode: the display only shows the panel rows the area lies in (a band of columns in landscape)
+//and drawing is clipped to the area. LCD_setIdleMode can be added on top for 8 colours.
+void GFX_enterPartialMode(int16_t x, int16_t y, int16_t w, int16_t h);
+//Shows the whole display again and resets the clip. Partial mode ended any vertical scrolling.
+void GFX_exitPartialMode();
 void GFX_setClearColor(struct Color color);
 void GFX_clearScreen();
 
@@ -46,7 +198,35 @@ void GFX_fillCircle(int16_t x0, int16_t y0, int16_t r, struct Color color);
 void GFX_drawTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, struct Color color);
 void GFX_fillTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, struct Color color);
 
+//Formats into a buffer of GFX_PRINTF_SIZE on the stack, longer text is cut off. Integers, characters and strings
+//with the - and 0 flags and a width are converted without going through vsnprintf.
+//With USE_TEXT_RUNS, built-in font text with a background that fits on the line is drawn into a strip
+//and sent with one write, without a framebuffer and outside of frames
 void GFX_printf(uint8_t textsize, const char *format, ...);
+//Prints value / 10^decimals (up to 9 decimals) at the cursor, e.g. 2345 with 2 decimals as 23.45
+void GFX_printFixed(int32_t value, uint8_t decimals, uint8_t textsize);
+
+//Area the text would cover printed at x, y in the current font, with wrapping and line ends as GFX_printf does.
+//Built-in font characters count whole cells with their spacing. w and h are 0 for text that draws nothing.
+void GFX_getTextBounds(const char *s, int16_t x, int16_t y, uint8_t textsize, int16_t *x1, int16_t *y1, uint16_t *w,
+					   uint16_t *h);
+
+/// Where GFX_drawTextBox puts the text, a horizontal and a vertical value or'ed together
+enum GFX_TextAlign
+{
+	GFX_ALIGN_LEFT = 0x00,
+	GFX_ALIGN_CENTER = 0x01,
+	GFX_ALIGN_RIGHT = 0x02,
+	GFX_ALIGN_TOP = 0x00,
+	GFX_ALIGN_MIDDLE = 0x04,
+	GFX_ALIGN_BOTTOM = 0x08,
+};
+
+//Fills the box with the text background colour, unless it is the text colour, and draws the text aligned in it,
+//each line on its own. Lines don't wrap and the cursor doesn't move. Straight to the display, the box is drawn into
+//a buffer of its own and sent with one write, what doesn't fit is cut off. Otherwise characters that don't fit whole
+//are left out.
+void GFX_drawTextBox(int16_t x, int16_t y, int16_t w, int16_t h, uint8_t align, uint8_t textsize, const char *s);
 
 
 uint GFX_getWidth();
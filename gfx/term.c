@@ -0,0 +1,336 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include "term.h"
+
+#define CELL_WIDTH 6  ///< Built-in font cell, glyph and spacing, at textsize 1
+#define CELL_HEIGHT 8
+#define MAX_PARAMS 8 ///< Numbers kept from one escape sequence
+
+struct Cell
+{
+	uint8_t c;
+	uint8_t attr;
+};
+
+static struct Cell cells[TERM_MAX_CELLS]; ///< What the grid holds
+static struct Cell shown[TERM_MAX_CELLS]; ///< What the last TERM_refresh left on the display
+static bool shownValid = false;			  ///< Otherwise the next refresh draws every cell
+
+enum EscapeState
+{
+	ESC_NONE,
+	ESC_START, ///< ESC received
+	ESC_CSI,   ///< ESC [ received, reading parameters
+};
+
+static struct
+{
+	int16_t x, y;
+	uint8_t cols, rows;
+	uint8_t size;
+	uint8_t col, row; ///< Cursor
+	uint8_t fg, bg;
+	bool bold; ///< Foreground colours 0-7 are shown bright
+	enum EscapeState escape;
+	uint8_t params[MAX_PARAMS];
+	uint8_t nparams;
+} term;
+
+static struct Color colors[16] = {
+	{0x00, 0x00, 0x00},
+	{0xAA, 0x00, 0x00},
+	{0x00, 0xAA, 0x00},
+	{0xAA, 0x55, 0x00},
+	{0x00, 0x00, 0xAA},
+	{0xAA, 0x00, 0xAA},
+	{0x00, 0xAA, 0xAA},
+	{0xAA, 0xAA, 0xAA},
+	{0x55, 0x55, 0x55},
+	{0xFF, 0x55, 0x55},
+	{0x55, 0xFF, 0x55},
+	{0xFF, 0xFF, 0x55},
+	{0x55, 0x55, 0xFF},
+	{0xFF, 0x55, 0xFF},
+	{0x55, 0xFF, 0xFF},
+	{0xFF, 0xFF, 0xFF},
+};
+
+static uint8_t currentAttr()
+{
+	uint8_t fg = term.bold && term.fg < TERM_BRIGHT ? term.fg + TERM_BRIGHT : term.fg;
+	return TERM_ATTR(fg, term.bg);
+}
+
+static void blankLines(uint8_t first, uint8_t count)
+{
+	struct Cell blank = {' ', currentAttr()};
+	for (uint32_t i = first * term.cols; i < (uint32_t)(first + count) * term.cols; i++)
+		cells[i] = blank;
+}
+
+bool TERM_init(int16_t x, int16_t y, uint8_t cols, uint8_t rows, uint8_t textsize)
+{
+	if ((uint32_t)cols * rows > TERM_MAX_CELLS || cols == 0 || rows == 0 || textsize == 0)
+		return false;
+	memset(&term, 0, sizeof(term));
+	term.x = x;
+	term.y = y;
+	term.cols = cols;
+	term.rows = rows;
+	term.size = textsize;
+	term.fg = TERM_WHITE;
+	term.bg = TERM_BLACK;
+	blankLines(0, rows);
+	shownValid = false;
+	return true;
+}
+
+void TERM_clear()
+{
+	blankLines(0, term.rows);
+	term.col = 0;
+	term.row = 0;
+}
+
+void TERM_setCursor(uint8_t col, uint8_t row)
+{
+	term.col = col < term.cols ? col : term.cols - 1;
+	term.row = row < term.rows ? row : term.rows - 1;
+}
+
+void TERM_setColor(uint8_t fg, uint8_t bg)
+{
+	term.fg = fg & 0x0F;
+	term.bg = bg & 0x0F;
+}
+
+void TERM_setPaletteColor(uint8_t index, struct Color color)
+{
+	colors[index & 0x0F] = color;
+	shownValid = false; // Cells in that colour have to be drawn again
+}
+
+void TERM_setCell(uint8_t col, uint8_t row, char c, uint8_t attr)
+{
+	if (col < term.cols && row < term.rows)
+		cells[row * term.cols + col] = (struct Cell){c, attr};
+}
+
+void TERM_scroll(uint8_t lines)
+{
+	if (lines > term.rows)
+		lines = term.rows;
+	memmove(cells, &cells[lines * term.cols], (term.rows - lines) * term.cols * sizeof(struct Cell));
+	blankLines(term.rows - lines, lines);
+}
+
+static void newLine()
+{
+	term.col = 0;
+	if (term.row + 1 < term.rows)
+		term.row++;
+	else
+		TERM_scroll(1);
+}
+
+// Select Graphic Rendition, the colour part of it
+static void applySGR()
+{
+	if (term.nparams == 0)
+		term.params[term.nparams++] = 0; // ESC [ m is a reset
+	for (uint8_t i = 0; i < term.nparams; i++)
+	{
+		uint8_t p = term.params[i];
+		if (p == 0)
+		{
+			term.fg = TERM_WHITE;
+			term.bg = TERM_BLACK;
+			term.bold = false;
+		}
+		else if (p == 1)
+			term.bold = true;
+		else if (p == 22)
+			term.bold = false;
+		else if (p >= 30 && p <= 37)
+			term.fg = p - 30;
+		else if (p == 39)
+			term.fg = TERM_WHITE;
+		else if (p >= 40 && p <= 47)
+			term.bg = p - 40;
+		else if (p == 49)
+			term.bg = TERM_BLACK;
+		else if (p >= 90 && p <= 97)
+			term.fg = p - 90 + TERM_BRIGHT;
+		else if (p >= 100 && p <= 107)
+			term.bg = p - 100 + TERM_BRIGHT;
+	}
+}
+
+// Returns true when c was part of an escape sequence
+static bool escapeChar(char c)
+{
+	switch (term.escape)
+	{
+	case ESC_NONE:
+		if (c != '\x1b')
+			return false;
+		term.escape = ESC_START;
+		return true;
+	case ESC_START:
+		if (c == '[')
+		{
+			term.escape = ESC_CSI;
+			term.nparams = 0;
+			memset(term.params, 0, sizeof(term.params));
+		}
+		else
+			term.escape = ESC_NONE; // Two character sequence, skipped
+		return true;
+	case ESC_CSI:
+		if (c >= '0' && c <= '9')
+		{
+			if (term.nparams == 0)
+				term.nparams = 1;
+			if (term.nparams <= MAX_PARAMS)
+			{
+				uint16_t p = term.params[term.nparams - 1] * 10 + (c - '0');
+				term.params[term.nparams - 1] = p > 255 ? 255 : p;
+			}
+		}
+		else if (c == ';')
+		{
+			if (term.nparams == 0)
+				term.nparams = 1; // Empty first parameter
+			if (term.nparams <= MAX_PARAMS)
+				term.nparams++;
+		}
+		else if (c >= 0x40 && c <= 0x7E)
+		{
+			if (term.nparams > MAX_PARAMS)
+				term.nparams = MAX_PARAMS;
+			if (c == 'm')
+				applySGR();
+			term.escape = ESC_NONE;
+		}
+		return true;
+	}
+	return false;
+}
+
+void TERM_putc(char c)
+{
+	if (escapeChar(c))
+		return;
+	switch (c)
+	{
+	case '\n':
+		newLine();
+		break;
+	case '\r':
+		term.col = 0;
+		break;
+	case '\b':
+		if (term.col > 0)
+			term.col--;
+		break;
+	case '\t':
+	{
+		// Computed wide, a uint8_t column near 255 would wrap to 0
+		unsigned int next = (term.col + 8u) & ~7u;
+		if (next >= term.cols)
+			newLine();
+		else
+			term.col = next;
+		break;
+	}
+	default:
+		if (term.col >= term.cols)
+			newLine();
+		cells[term.row * term.cols + term.col] = (struct Cell){c, currentAttr()};
+		term.col++;
+		break;
+	}
+}
+
+void TERM_write(const char *s)
+{
+	while (*s)
+		TERM_putc(*s++);
+}
+
+void TERM_printf(const char *format, ...)
+{
+	char text[TERM_PRINTF_SIZE];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	TERM_write(text);
+}
+
+static bool sameCell(struct Cell a, struct Cell b)
+{
+	return a.c == b.c && a.attr == b.attr;
+}
+
+// Draws cells first..end-1 of a line, into a framebuffer of their own unless
+// one is there already
+static void drawRun(uint8_t row, uint8_t first, uint8_t end, bool ownBuffer)
+{
+	int16_t cw = CELL_WIDTH * term.size;
+	int16_t ch = CELL_HEIGHT * term.size;
+	int16_t x = term.x + first * cw;
+	int16_t y = term.y + row * ch;
+	if (ownBuffer)
+		GFX_createFramebuf(x, y, (end - first) * cw, ch);
+	for (uint8_t col = first; col < end; col++, x += cw)
+	{
+		struct Cell cell = cells[row * term.cols + col];
+		struct Color fg = colors[cell.attr & 0x0F];
+		struct Color bg = colors[cell.attr >> 4];
+		if (fg.r == bg.r && fg.g == bg.g && fg.b == bg.b)
+			GFX_fillRect(x, y, cw, ch, bg); // drawChar would leave the background out
+		else
+			GFX_drawChar(x, y, cell.c, fg, bg, term.size, term.size);
+	}
+	if (ownBuffer)
+	{
+		GFX_flush();
+		GFX_destroyFramebuf();
+	}
+}
+
+void TERM_refresh()
+{
+	bool ownBuffer = !hasFrameBuffer();
+	uint32_t cellBytes = (uint32_t)CELL_WIDTH * CELL_HEIGHT * term.size * term.size * 3;
+	uint32_t maxRun = BUFFER_MAX_SIZE / cellBytes; // Cells one RGB666 framebuffer can take
+	if (maxRun == 0)
+		maxRun = 1; // Too big for a framebuffer, drawn straight to the display
+	for (uint8_t row = 0; row < term.rows; row++)
+	{
+		struct Cell *now = &cells[row * term.cols];
+		struct Cell *was = &shown[row * term.cols];
+		uint8_t col = 0;
+		while (col < term.cols)
+		{
+			if (shownValid && sameCell(now[col], was[col]))
+			{
+				col++;
+				continue;
+			}
+			uint8_t first = col;
+			while (col < term.cols && (uint32_t)(col - first) < maxRun && !(shownValid && sameCell(now[col], was[col])))
+				col++;
+			drawRun(row, first, col, ownBuffer);
+			memcpy(&was[first], &now[first], (col - first) * sizeof(struct Cell));
+		}
+	}
+	shownValid = true;
+}
+
+void TERM_invalidate()
+{
+	shownValid = false;
+}
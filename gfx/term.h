@@ -0,0 +1,67 @@
+#ifndef term_H
+#define term_H
+
+#include "gfx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef TERM_MAX_CELLS
+#define TERM_MAX_CELLS (80 * 40) ///< Cells of the largest grid, 80 x 40 cells of 6x8 fill 480x320
+#endif
+#ifndef TERM_PRINTF_SIZE
+#define TERM_PRINTF_SIZE 128 ///< Longest text a single TERM_printf writes
+#endif
+
+/// Attribute of a cell: foreground colour in the low nibble, background in the high one
+#define TERM_ATTR(fg, bg) ((uint8_t)(((bg) << 4) | ((fg) & 0x0F)))
+
+/// The 16 colours cells use, the usual ANSI order
+enum TERM_ColorIndex
+{
+	TERM_BLACK,
+	TERM_RED,
+	TERM_GREEN,
+	TERM_YELLOW,
+	TERM_BLUE,
+	TERM_MAGENTA,
+	TERM_CYAN,
+	TERM_WHITE,
+	TERM_BRIGHT, ///< Added to the others for their bright variants
+};
+
+//A grid of cols x rows cells of the built-in font at textsize, its top left corner at x, y.
+//Returns false when it has more than TERM_MAX_CELLS cells. The grid starts blank, white on black,
+//and the first TERM_refresh draws it whole.
+bool TERM_init(int16_t x, int16_t y, uint8_t cols, uint8_t rows, uint8_t textsize);
+//Blanks all cells in the current colours and puts the cursor top left
+void TERM_clear();
+void TERM_setCursor(uint8_t col, uint8_t row);
+//Colours of the cells written from now on, indices into the 16 colours
+void TERM_setColor(uint8_t fg, uint8_t bg);
+void TERM_setPaletteColor(uint8_t index, struct Color color);
+
+//Writes at the cursor. \n goes to the start of the next line, \r to the start of this one, \b back and \t to
+//the next multiple of 8. Past the last line the grid scrolls. ESC [ ... m sets the colours (SGR 0, 1, 22,
+//30-37, 39, 40-47, 49, 90-97, 100-107), other escape sequences are skipped.
+void TERM_putc(char c);
+void TERM_write(const char *s);
+void TERM_printf(const char *format, ...);
+//Sets one cell without moving the cursor
+void TERM_setCell(uint8_t col, uint8_t row, char c, uint8_t attr);
+//Moves the lines up, the ones coming in at the bottom are blank in the current colours
+void TERM_scroll(uint8_t lines);
+
+//Draws the cells that changed since the last refresh. Changed cells next to each other on a line are drawn into one
+//framebuffer and sent with one window write. With a framebuffer already created, they are drawn into it instead.
+//Not for use between GFX_beginFrame and GFX_endFrame.
+void TERM_refresh();
+//Makes the next TERM_refresh draw every cell, e.g. after something else was drawn over the grid
+void TERM_invalidate();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
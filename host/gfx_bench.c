@@ -0,0 +1,1215 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "gfx.h"
+#include "term.h"
+#include "ili9488.h"
+#include "ili9488_sim.h"
+
+// Runs a fixed workload for every gfx primitive on the simulated panel and
+// reports what each one costs on the wire.
+//
+//   gfx_bench                 print the table
+//   gfx_bench --write FILE    also store frame hashes and byte counts
+//   gfx_bench --check FILE    fail if a frame differs from FILE or a case
+//                             sends more bytes than recorded there
+
+// Without USE_FRAMEBUFFER_ARENA gfx mallocs its framebuffers, count them through --wrap
+void *__real_malloc(size_t size);
+void __real_free(void *p);
+
+static uint32_t mallocs;
+static uint32_t frees;
+
+void *__wrap_malloc(size_t size)
+{
+	mallocs++;
+	return __real_malloc(size);
+}
+
+void __wrap_free(void *p)
+{
+	if (p != NULL)
+		frees++;
+	__real_free(p);
+}
+
+static const struct Color black = {0x00, 0x00, 0x00};
+static const struct Color white = {0xFF, 0xFF, 0xFF};
+static const struct Color red = {0xFF, 0x00, 0x00};
+static const struct Color green = {0x00, 0xFF, 0x00};
+static const struct Color blue = {0x00, 0x00, 0xFF};
+static const struct Color amber = {0xFF, 0xB0, 0x00};
+static const struct Color navy = {0x10, 0x20, 0x40};
+
+static struct Color palette(int i)
+{
+	const struct Color c[] = {white, red, green, blue, amber};
+	return c[i % 5];
+}
+
+static void benchFillRectSmall()
+{
+	for (int i = 0; i < 100; i++)
+		GFX_fillRect((i * 37) % 470, (i * 23) % 310, 10, 10, palette(i));
+}
+
+static void benchFillRectLarge()
+{
+	for (int i = 0; i < 5; i++)
+		GFX_fillRect(i * 50, i * 30, 200, 150, palette(i));
+}
+
+static void benchClearScreen()
+{
+	GFX_setClearColor(navy);
+	GFX_clearScreen();
+}
+
+static void benchDrawPixel()
+{
+	for (int i = 0; i < 1000; i++)
+		GFX_drawPixel((i * 7919) % 480, (i * 104729) % 320, palette(i));
+}
+
+static void benchDrawLine()
+{
+	for (int i = 0; i < 50; i++)
+		GFX_drawLine((i * 41) % 480, (i * 13) % 320, 479 - (i * 29) % 480, 319 - (i * 17) % 320, palette(i));
+}
+
+static void benchFastLines()
+{
+	for (int i = 0; i < 50; i++)
+	{
+		GFX_drawFastHLine(10, 5 + i * 6, 460, palette(i));
+		GFX_drawFastVLine(5 + i * 9, 10, 300, palette(i + 1));
+	}
+}
+
+static void benchDrawRect()
+{
+	for (int i = 0; i < 20; i++)
+		GFX_drawRect(i * 10, i * 7, 480 - i * 20, 320 - i * 14, palette(i));
+}
+
+static void benchDrawCircle()
+{
+	for (int i = 0; i < 10; i++)
+		GFX_drawCircle(40 + i * 44, 160, 15 + i * 3, palette(i));
+}
+
+static void benchFillCircle()
+{
+	for (int i = 0; i < 10; i++)
+		GFX_fillCircle(40 + i * 44, 80 + (i % 3) * 80, 15 + i * 2, palette(i));
+}
+
+static void benchFillTriangle()
+{
+	for (int i = 0; i < 10; i++)
+		GFX_fillTriangle(i * 45, 300, i * 45 + 40, 310 - i * 20, i * 45 + 20, 20 + i * 5, palette(i));
+}
+
+static void benchFillRoundedRect()
+{
+	for (int i = 0; i < 10; i++)
+		GFX_fillRoundedRect(10 + (i % 5) * 94, 20 + (i / 5) * 150, 84, 120, 4 + i * 2, palette(i));
+}
+
+static void drawChars(uint8_t size)
+{
+	for (int i = 0; i < 40; i++)
+		GFX_drawChar((i % 20) * 6 * size, (i / 20) * 8 * size, '0' + i % 10, white, navy, size, size);
+}
+
+static void benchDrawChar1()
+{
+	drawChars(1);
+}
+
+static void benchDrawChar2()
+{
+	drawChars(2);
+}
+
+static void benchDrawChar4()
+{
+	drawChars(4);
+}
+
+// Two glyphs, '1' and '2', of a custom font
+static uint8_t tinyFontBitmaps[] = {0x59, 0x2E, 0xE1, 0x68, 0xF0};
+static GFXglyph tinyFontGlyphs[] = {
+	{0, 3, 5, 5, 0, -5},
+	{2, 4, 5, 5, 0, -5},
+};
+static const GFXfont tinyFont = {tinyFontBitmaps, tinyFontGlyphs, '1', '2', 7};
+
+// Large readout digits, diacritics and transparent text in both fonts
+static void benchScaledText()
+{
+	for (int i = 0; i < 6; i++)
+		GFX_drawChar(10 + i * 36, 10, '0' + i, amber, navy, 6, 6);
+	addExtraCharacter(L'Á');
+	addExtraCharacter(L'Ů');
+	addExtraCharacter(L'ď');
+	addExtraCharacter(L'ť');
+	addExtraCharacter(L'č');
+	const char *accented = "AU\x80\x81\x82\x83\x84";
+	for (int i = 0; accented[i]; i++)
+	{
+		GFX_drawChar(10 + i * 24, 90, accented[i], white, blue, 4, 4);
+		GFX_drawChar(10 + i * 12, 140, accented[i], green, green, 2, 2);
+		GFX_drawChar(200 + i * 12, 140, accented[i], white, navy, 2, 2);
+	}
+	GFX_drawChar(10, 170, 'W', red, red, 3, 3);
+	GFX_setFont(&tinyFont);
+	GFX_setTextColor(white);
+	GFX_setCursor(10, 240);
+	GFX_printf(3, "1221");
+	GFX_setCursor(100, 240);
+	GFX_printf(1, "12");
+	GFX_setFont(NULL);
+}
+
+static void benchPrintf()
+{
+	GFX_setTextColor(amber);
+	GFX_setTextBack(black);
+	for (int i = 0; i < 10; i++)
+	{
+		GFX_setCursor(4, 4 + i * 24);
+		GFX_printf(2, "T%d=%d.%02d C", i, 20 + i, (i * 37) % 100);
+	}
+}
+
+// A 12x10 battery, rows padded to whole bytes
+static const uint8_t batteryIcon[] = {
+	0x3F, 0xC0, 0x20, 0x40, 0xFF, 0xF0, 0x80, 0x10, 0xB6, 0xD0,
+	0xB6, 0xD0, 0xB6, 0xD0, 0x80, 0x10, 0xFF, 0xF0, 0x00, 0x00,
+};
+
+// Icons scaled up, opaque and transparent, one partly off the screen, drawn
+// straight to the panel, through a framebuffer or as a frame
+static void drawIcons()
+{
+	GFX_fillRect(0, 100, 480, 80, black);
+	GFX_drawBitmapScaled(10, 100, batteryIcon, 12, 10, green, navy, 5, 5);
+	GFX_drawBitmapScaled(100, 110, batteryIcon, 12, 10, amber, amber, 3, 3);
+	GFX_drawBitmapScaled(160, 100, batteryIcon, 12, 10, white, blue, 2, 7);
+	GFX_drawBitmapScaled(450, 120, batteryIcon, 12, 10, red, black, 4, 4);
+}
+
+// The clip isn't recorded with a frame, this one is drawn outside of them
+static void drawClippedIcon()
+{
+	GFX_setClip(300, 100, 60, 40);
+	GFX_drawBitmapScaled(290, 90, batteryIcon, 12, 10, white, red, 6, 6);
+	GFX_resetClip();
+}
+
+static void benchIconsDirect()
+{
+	drawIcons();
+	drawClippedIcon();
+}
+
+static void benchIconsFramebuf()
+{
+	GFX_createFramebuf(0, 100, 480, 80);
+	drawIcons();
+	drawClippedIcon();
+	GFX_flush();
+	GFX_destroyFramebuf();
+}
+
+// Ten updates of three labels, each drawn over the box it had before: a value
+// centred, a custom font value at the right and two lines in the middle
+static void drawLabelBoxes()
+{
+	char text[32];
+	for (int tick = 0; tick < 10; tick++)
+	{
+		GFX_setTextColor(white);
+		GFX_setTextBack(navy);
+		snprintf(text, sizeof(text), "%d rpm", 800 + tick * 137);
+		GFX_drawTextBox(40, 60, 200, 30, GFX_ALIGN_CENTER | GFX_ALIGN_MIDDLE, 2, text);
+		GFX_setFont(&tinyFont);
+		GFX_setTextColor(amber);
+		GFX_setTextBack(black);
+		GFX_drawTextBox(260, 60, 120, 30, GFX_ALIGN_RIGHT | GFX_ALIGN_BOTTOM, 3, tick & 1 ? "1221" : "12");
+		GFX_setFont(NULL);
+		GFX_setTextColor(green);
+		snprintf(text, sizeof(text), "Pump %d\nOK", tick);
+		GFX_drawTextBox(40, 110, 120, 50, GFX_ALIGN_CENTER | GFX_ALIGN_MIDDLE, 2, text);
+	}
+}
+
+static void benchLabelBoxes()
+{
+	drawLabelBoxes();
+}
+
+static void benchLabelBoxesFramebuf()
+{
+	GFX_createFramebuf(30, 55, 360, 110);
+	GFX_fillRect(30, 55, 360, 110, black);
+	drawLabelBoxes();
+	GFX_flush();
+	GFX_destroyFramebuf();
+}
+
+// The centred label the usual way, a generous clear under text placed by hand
+static void benchLabelClear()
+{
+	GFX_setTextColor(white);
+	GFX_setTextBack(navy);
+	for (int tick = 0; tick < 10; tick++)
+	{
+		GFX_fillRect(20, 60, 440, 30, navy);
+		GFX_setCursor(88, 67);
+		GFX_printf(2, "%d rpm", 800 + tick * 137);
+	}
+}
+
+// A counter readout printed again and again in the same colours, each value
+// drawn either straight to the panel or through a framebuffer around it
+static void drawCounter(bool framebuf)
+{
+	GFX_setTextColor(green);
+	GFX_setTextBack(black);
+	for (int value = 0; value < 500; value += 7)
+	{
+		if (framebuf)
+			GFX_createFramebuf(40, 40, 6 * 2 * 9, 8 * 2);
+		GFX_setCursor(40, 40);
+		GFX_printf(2, "%5d.%d V", value / 10, value % 10);
+		if (framebuf)
+		{
+			GFX_flush();
+			GFX_destroyFramebuf();
+		}
+	}
+}
+
+static void benchCounterDirect()
+{
+	drawCounter(false);
+}
+
+static void benchCounterFramebuf()
+{
+	drawCounter(true);
+}
+
+// Text that wraps at the right edge and has line ends in it, drawn either
+// straight to the panel or through a framebuffer around it
+static void drawWrappedText(bool framebuf)
+{
+	if (framebuf)
+		GFX_createFramebuf(0, 200, 480, 48);
+	GFX_fillRect(0, 200, 480, 48, black);
+	GFX_setTextColor(white);
+	GFX_setTextBack(blue);
+	GFX_setCursor(300, 200);
+	GFX_printf(2, "Pump %d: %d rpm, %d.%d bar\nFlow %d l/min\rOK", 2, 1450, 3, 7, 118);
+	if (framebuf)
+	{
+		GFX_flush();
+		GFX_destroyFramebuf();
+	}
+}
+
+static void benchWrapDirect()
+{
+	drawWrappedText(false);
+}
+
+static void benchWrapFramebuf()
+{
+	drawWrappedText(true);
+}
+
+// The formats GFX_printf converts itself, mixed with ones it leaves to
+// vsnprintf, and text longer than GFX_PRINTF_SIZE. Printed either by
+// GFX_printf or by snprintf and then GFX_printf("%s"), same result.
+#define FORMAT_CASES(PRINT)                                                                             \
+	PRINT("%d|%5d|%-5d|%05d|%i|%d", 42, -42, 7, -7, 0, -2147483647 - 1);                                \
+	PRINT("%u %x %X %08x %lu %ld %hd %c%-3c| %%", 4000000000u, 0xbeefu, 0xbeefu, 255u, 123456789ul,    \
+		  -5l, (short)-3, 'A', 'b');                                                                      \
+	PRINT("%s|%8s|%-8s|%d %.2f %d", "abc", "right", "left", 1, 3.14159, 2);                             \
+	PRINT("%+d %.3s %ld%%", 5, "truncated", 99l);                                                       \
+	PRINT("%hx %hu %hd %hhd %hhu %hhX", (short)-1, (unsigned short)-2, 70000, 300, -1, 0x1234);         \
+	PRINT("%s", "A long line that goes on past the end of the buffer GFX_printf formats into, which "  \
+				"used to be a global of 100 bytes and overflowed, now it is cut off at 127 characters.")
+
+static int formatLine;
+
+static void printLine(const char *format, ...)
+{
+	GFX_setCursor(0, 10 * formatLine++);
+	va_list args;
+	va_start(args, format);
+	char text[GFX_PRINTF_SIZE];
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	GFX_printf(1, "%s", text);
+}
+
+#define GFX_PRINT_LINE(...)                                                                             \
+	do                                                                                                  \
+	{                                                                                                   \
+		GFX_setCursor(0, 10 * formatLine++);                                                            \
+		GFX_printf(1, __VA_ARGS__);                                                                     \
+	} while (0)
+
+static void benchPrintfFormats()
+{
+	formatLine = 0;
+	GFX_setTextColor(white);
+	GFX_setTextBack(navy);
+	FORMAT_CASES(GFX_PRINT_LINE);
+}
+
+static void benchSnprintfFormats()
+{
+	formatLine = 0;
+	GFX_setTextColor(white);
+	GFX_setTextBack(navy);
+	FORMAT_CASES(printLine);
+}
+
+// Readouts in fixed point, printed either with GFX_printFixed or with printf
+static const int32_t fixedValues[] = {0, 5, -5, 123, -123, 2345, 100000, -2147483647 - 1, 2147483647};
+
+static void benchPrintFixed()
+{
+	GFX_setTextColor(amber);
+	GFX_setTextBack(black);
+	for (uint8_t i = 0; i < sizeof(fixedValues) / sizeof(fixedValues[0]); i++)
+	{
+		for (uint8_t decimals = 0; decimals <= 4; decimals++)
+		{
+			GFX_setCursor(decimals * 96, i * 20);
+			GFX_printFixed(fixedValues[i], decimals, 1);
+		}
+	}
+}
+
+static void benchPrintFixedPrintf()
+{
+	static const int32_t scale[] = {1, 10, 100, 1000, 10000};
+	GFX_setTextColor(amber);
+	GFX_setTextBack(black);
+	for (uint8_t i = 0; i < sizeof(fixedValues) / sizeof(fixedValues[0]); i++)
+	{
+		for (uint8_t decimals = 0; decimals <= 4; decimals++)
+		{
+			long long v = fixedValues[i];
+			unsigned long long m = v < 0 ? -v : v;
+			GFX_setCursor(decimals * 96, i * 20);
+			if (decimals == 0)
+				GFX_printf(1, "%s%llu", v < 0 ? "-" : "", m);
+			else
+				GFX_printf(1, "%s%llu.%0*llu", v < 0 ? "-" : "", m / scale[decimals], decimals, m % scale[decimals]);
+		}
+	}
+}
+
+// A small dashboard widget, drawn either straight to the panel or through a
+// framebuffer covering it
+static void drawWidget()
+{
+	GFX_fillRect(100, 60, 200, 100, navy);
+	GFX_drawRect(100, 60, 200, 100, white);
+	GFX_fillCircle(140, 110, 25, green);
+	GFX_fillRoundedRect(180, 80, 100, 24, 6, amber);
+	GFX_drawLine(180, 150, 290, 115, red);
+	GFX_setTextColor(white);
+	GFX_setTextBack(navy);
+	GFX_setCursor(180, 130);
+	GFX_printf(1, "%d rpm", 1234);
+}
+
+static void benchWidgetDirect()
+{
+	drawWidget();
+}
+
+static void benchWidgetFramebuf()
+{
+	GFX_createFramebuf(100, 60, 200, 100);
+	drawWidget();
+	GFX_flush();
+	GFX_destroyFramebuf();
+}
+
+#ifdef USE_RGB565_FRAMEBUF
+// The widget drawn into a 16-bit framebuffer, converted to RGB666 when flushed
+static void benchWidget565()
+{
+	GFX_setFramebufFormat(GFX_FORMAT_RGB565);
+	GFX_createFramebuf(100, 60, 200, 100);
+	drawWidget();
+	GFX_flush();
+	GFX_destroyFramebuf();
+	GFX_setFramebufFormat(GFX_FORMAT_RGB666);
+}
+
+static void drawWideStrip()
+{
+	GFX_fillRect(0, 150, 500, 4, navy);
+	GFX_drawFastHLine(10, 151, 490, white);
+}
+
+// A strip wider than the screen. Its rows don't fit into the line buffers it
+// would be converted in, so the framebuffer isn't created and the strip is
+// drawn directly, the frame of wide_direct.
+static void benchWide565()
+{
+	GFX_setFramebufFormat(GFX_FORMAT_RGB565);
+	GFX_createFramebuf(0, 150, 500, 4);
+	if (hasFrameBuffer())
+		printf("framebuffer wider than the line buffers in wide_565\n");
+	drawWideStrip();
+	GFX_flush();
+	GFX_destroyFramebuf();
+	GFX_setFramebufFormat(GFX_FORMAT_RGB666);
+}
+
+static void benchWideDirect()
+{
+	drawWideStrip();
+}
+#endif
+
+// The widget drawn twice into a double framebuffer, the first flush is still
+// being sent while the second copy is drawn
+static void benchWidgetDoubleBuf()
+{
+	GFX_createDoubleFramebuf(100, 60, 200, 100);
+	for (int i = 0; i < 2; i++)
+	{
+		drawWidget();
+		GFX_flush();
+	}
+	GFX_destroyFramebuf();
+}
+
+static int firstGauge = 0; ///< Value shown by the first gauge
+
+// A full screen of gauges and text, drawn either directly or recorded and
+// sent in bands
+static void drawDashboard()
+{
+	GFX_setClearColor(black);
+	GFX_clearScreen();
+	for (int i = 0; i < 6; i++)
+	{
+		int16_t x = 10 + (i % 3) * 156;
+		int16_t y = 10 + (i / 3) * 150;
+		GFX_fillRoundedRect(x, y, 148, 140, 10, navy);
+		GFX_drawCircle(x + 74, y + 60, 40, white);
+		GFX_fillCircle(x + 74, y + 60, 8, palette(i));
+		GFX_drawLine(x + 74, y + 60, x + 40 + i * 12, y + 30, palette(i));
+		GFX_fillTriangle(x + 10, y + 130, x + 40, y + 100, x + 70, y + 130, palette(i + 1));
+		GFX_setTextColor(white);
+		GFX_setTextBack(navy);
+		GFX_setCursor(x + 80, y + 110);
+		GFX_printf(2, "%3d%%", i ? i * 17 : firstGauge);
+	}
+}
+
+static void benchDashboardDirect()
+{
+	drawDashboard();
+}
+
+// The dashboard left in partial and idle mode, then a warm restart: the
+// picture has to come back the same as dashboard_direct, without a redraw
+static void benchRestartWarm()
+{
+	drawDashboard();
+	LCD_enterPartialMode(0, 31);
+	LCD_setIdleMode(true);
+	LCD_initDisplayWarm();
+	LCD_setRotation(1);
+}
+
+#ifdef USE_INDEXED_FRAMEBUF
+// The dashboard drawn into one indexed framebuffer covering the whole screen,
+// in the default RGB332 palette
+static void benchDashboardIndexed()
+{
+	GFX_setFramebufFormat(GFX_FORMAT_INDEXED8);
+	GFX_createFramebuf(0, 0, 480, 320);
+	drawDashboard();
+	GFX_flush();
+	GFX_destroyFramebuf();
+	GFX_setFramebufFormat(GFX_FORMAT_RGB666);
+}
+#endif
+
+#ifdef USE_RGB111_FRAMEBUF
+// The dashboard drawn into one full-screen 3-bit framebuffer and sent packed,
+// two pixels per byte, with the display in 3-bit mode
+static void benchDashboard3Bit()
+{
+	LCD_setColorMode(LCD_COLOR_3BIT);
+	GFX_setFramebufFormat(GFX_FORMAT_RGB111);
+	GFX_createFramebuf(0, 0, 480, 320);
+	drawDashboard();
+	GFX_flush();
+	GFX_destroyFramebuf();
+	GFX_setFramebufFormat(GFX_FORMAT_RGB666);
+	LCD_setColorMode(LCD_COLOR_18BIT);
+}
+
+// The dashboard drawn straight to the display in 3-bit mode
+static void benchDirect3Bit()
+{
+	LCD_setColorMode(LCD_COLOR_3BIT);
+	drawDashboard();
+	LCD_setColorMode(LCD_COLOR_18BIT);
+}
+#endif
+
+#ifdef USE_SCROLL_CONSOLE
+#define LOG_TOP 16
+#define LOG_LINES 55 ///< Lines of text above the empty line the cursor waits on
+
+static void logLine(int i)
+{
+	GFX_printf(1, "%03d: sensor %d reads %4d mV\n", i, i % 7, (i * 337) % 5000);
+}
+
+// Portrait log with a header and a footer that stay put
+static void drawLogFrame()
+{
+	LCD_setRotation(0);
+	GFX_fillRect(0, 0, 320, LOG_TOP, navy);
+	GFX_fillRect(0, 480 - LOG_TOP, 320, LOG_TOP, navy);
+	GFX_setTextColor(amber);
+	GFX_setTextBack(navy);
+	GFX_setCursor(4, 4);
+	GFX_printf(1, "LOG");
+	GFX_setCursor(4, 480 - LOG_TOP + 4);
+	GFX_printf(1, "running");
+	GFX_setTextColor(white);
+	GFX_setTextBack(black);
+}
+
+// A full log gets 20 more lines, each one scrolls the display by a line.
+// Only those 20 lines are counted.
+static void benchConsoleScroll()
+{
+	drawLogFrame();
+	GFX_startConsole(LOG_TOP, LOG_TOP, 1);
+	for (int i = 0; i <= LOG_LINES; i++)
+		logLine(i);
+
+	SIM_resetStats();
+#ifdef USE_STATS
+	LCD_resetStats();
+#endif
+	for (int i = LOG_LINES + 1; i <= LOG_LINES + 20; i++)
+		logLine(i);
+}
+
+// The same 20 lines, the whole log redrawn for each one
+static void benchConsoleRedraw()
+{
+	drawLogFrame();
+	for (int i = LOG_LINES + 1; i <= LOG_LINES + 20; i++)
+	{
+		GFX_fillRect(0, LOG_TOP, 320, 480 - 2 * LOG_TOP, black);
+		GFX_setCursor(0, LOG_TOP);
+		for (int j = i - LOG_LINES + 1; j <= i; j++)
+			logLine(j);
+	}
+}
+#endif
+
+// A maintenance screen of 80 x 40 cells, one status line per channel
+static void drawStatusScreen(int tick)
+{
+	TERM_setCursor(0, 0);
+	TERM_write("\x1b[1;37;44m CHANNEL STATUS                                                                 \x1b[0m\n");
+	for (int i = 0; i < 36; i++)
+	{
+		int value = (i * 97 + (i % 5 == 0 ? tick : 0)) % 1000;
+		TERM_printf("ch%02d  \x1b[36mvalue\x1b[0m %4d  %s\x1b[0m  limit %4d\n", i, value,
+					value > 800 ? "\x1b[1;31mHIGH" : "\x1b[32mok  ", 800);
+	}
+}
+
+// The screen refreshed after 7 of its values changed, only those cells are counted
+static void benchTermUpdate()
+{
+	TERM_init(0, 0, 80, 40, 1);
+	drawStatusScreen(0);
+	TERM_refresh();
+
+	SIM_resetStats();
+#ifdef USE_STATS
+	LCD_resetStats();
+#endif
+	drawStatusScreen(3);
+	TERM_refresh();
+}
+
+// The same screen drawn whole
+static void benchTermFull()
+{
+	TERM_init(0, 0, 80, 40, 1);
+	drawStatusScreen(3);
+	TERM_refresh();
+}
+
+#ifdef USE_DISPLAY_LIST
+static void benchDashboardBanded()
+{
+	GFX_beginFrame();
+	drawDashboard();
+	if (!GFX_endFrame())
+		printf("display list overflow in dashboard_banded\n");
+}
+
+// A portrait screen with a status strip on top, the clock and battery change every tick
+static void drawStatusTick(int tick)
+{
+	GFX_fillRect(0, 0, 320, 32, navy);
+	GFX_setTextColor(white);
+	GFX_setTextBack(navy);
+	GFX_setCursor(6, 9);
+	GFX_printf(2, "12:%02d", tick);
+	GFX_drawRect(250, 8, 60, 16, white);
+	GFX_fillRect(252, 10, 56 - tick * 8, 12, green);
+	GFX_fillCircle(160, 200, 90, amber);
+	GFX_fillRoundedRect(40, 340, 240, 100, 12, blue);
+}
+
+// The labels recorded as frames and drawn in bands
+static void benchLabelBoxesFrame()
+{
+	GFX_beginFrame();
+	drawLabelBoxes();
+	GFX_endFrame();
+}
+
+// The icons recorded as a frame and drawn in bands
+static void benchIconsFrame()
+{
+	GFX_beginFrame();
+	drawIcons();
+	GFX_endFrame();
+	drawClippedIcon();
+}
+
+// Five ticks sent as whole frames
+static void benchStatusFull()
+{
+	LCD_setRotation(0);
+	for (int tick = 0; tick < 5; tick++)
+	{
+		GFX_beginFrame();
+		drawStatusTick(tick);
+		GFX_endFrame();
+	}
+}
+
+// The same ticks with only the strip shown, in idle mode, so frames only send the strip
+static void benchStatusPartial()
+{
+	LCD_setRotation(0);
+	GFX_enterPartialMode(0, 0, 320, 32);
+	LCD_setIdleMode(true);
+	for (int tick = 0; tick < 5; tick++)
+	{
+		GFX_beginFrame();
+		drawStatusTick(tick);
+		GFX_endFrame();
+	}
+}
+
+#ifdef USE_TILE_HASH
+// The dashboard drawn and sent in bands twice, the second time with one gauge
+// changed. Only the second frame is counted, its unchanged tiles stay home.
+static void benchDashboardTiles()
+{
+#ifdef USE_PARALLEL_BANDS
+	// Four parallel bands of BUFFER_MAX_SIZE are shorter than a tile
+	GFX_setRasterCores(1);
+#endif
+	GFX_beginFrame();
+	drawDashboard();
+	GFX_endFrame();
+
+	SIM_resetStats();
+#ifdef USE_STATS
+	LCD_resetStats();
+#endif
+	firstGauge = 42;
+	GFX_beginFrame();
+	drawDashboard();
+	GFX_endFrame();
+	firstGauge = 0;
+#ifdef USE_PARALLEL_BANDS
+	GFX_setRasterCores(2);
+#endif
+}
+
+// The dashboard sent in tiles, then sent again turned by 180 degrees and in
+// and out of 3-bit mode. Each change must send every tile again, the end
+// result is the same as tiles_fresh.
+static void benchTilesRotate()
+{
+#ifdef USE_PARALLEL_BANDS
+	GFX_setRasterCores(1);
+#endif
+	GFX_beginFrame();
+	drawDashboard();
+	GFX_endFrame();
+
+	LCD_setRotation(3);
+	GFX_beginFrame();
+	drawDashboard();
+	GFX_endFrame();
+
+	LCD_setColorMode(LCD_COLOR_3BIT);
+	GFX_beginFrame();
+	drawDashboard();
+	GFX_endFrame();
+
+	LCD_setColorMode(LCD_COLOR_18BIT);
+	GFX_beginFrame();
+	drawDashboard();
+	GFX_endFrame();
+#ifdef USE_PARALLEL_BANDS
+	GFX_setRasterCores(2);
+#endif
+}
+
+static void benchTilesFresh()
+{
+	LCD_setRotation(3);
+	GFX_clearScreen();
+	benchDashboardBanded();
+}
+#endif
+
+#ifdef USE_DIRTY_RECTS
+// The dashboard sent whole, then again with one gauge changed. Only the
+// second frame is counted, it sends just the digits that changed.
+static void benchDashboardDirty()
+{
+	GFX_beginFrame();
+	drawDashboard();
+	GFX_flushDirty();
+
+	SIM_resetStats();
+#ifdef USE_STATS
+	LCD_resetStats();
+#endif
+	firstGauge = 42;
+	GFX_beginFrame();
+	drawDashboard();
+	if (!GFX_flushDirty())
+		printf("display list overflow in dashboard_dirty\n");
+	firstGauge = 0;
+}
+
+// The same dashboard flushed again after turning the screen by 180 degrees,
+// which keeps its size. Nothing changed in the frame, but all of it has to
+// be sent again, ending with the frame of dashboard_banded.
+static void benchDirtyRotate()
+{
+	GFX_beginFrame();
+	drawDashboard();
+	GFX_flushDirty();
+
+	LCD_setRotation(3);
+	GFX_beginFrame();
+	drawDashboard();
+	GFX_flushDirty();
+}
+#endif
+#endif
+
+#ifdef USE_PARALLEL_BANDS
+// Many large filled shapes and text in one frame, the rasterization dominates
+static void drawScene()
+{
+	GFX_setClearColor(navy);
+	for (int i = 0; i < 60; i++)
+	{
+		GFX_fillTriangle((i * 53) % 480, (i * 31) % 320, (i * 97 + 150) % 480, (i * 13 + 80) % 320,
+						 (i * 71 + 40) % 480, (i * 59 + 200) % 320, palette(i));
+		GFX_fillCircle((i * 89) % 480, (i * 37) % 320, 20 + i % 40, palette(i + 2));
+	}
+	GFX_setTextColor(white);
+	GFX_setTextBack(black);
+	for (int i = 0; i < 8; i++)
+	{
+		GFX_setCursor(8, 8 + i * 38);
+		GFX_printf(3, "Band %d ok", i);
+	}
+}
+
+static void drawSceneBanded(uint8_t cores)
+{
+	GFX_setRasterCores(cores);
+	GFX_beginFrame();
+	drawScene();
+	if (!GFX_endFrame())
+		printf("display list overflow in scene\n");
+	GFX_setRasterCores(2);
+}
+
+static void benchSceneOneCore()
+{
+	drawSceneBanded(1);
+}
+
+static void benchSceneTwoCores()
+{
+	drawSceneBanded(2);
+}
+
+static double nowMs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Host time of the banded scene with one and with two cores drawing bands.
+// The panel doesn't decode the data meanwhile, so this is mostly rasterization.
+static void printRasterScaling()
+{
+	double best[2] = {1e9, 1e9};
+	SIM_setDecode(false);
+	for (int run = 0; run < 5; run++)
+	{
+		for (uint8_t cores = 1; cores <= 2; cores++)
+		{
+			SIM_reset();
+			LCD_initDisplay();
+			LCD_setRotation(1);
+			double start = nowMs();
+			drawSceneBanded(cores);
+			double ms = nowMs() - start;
+			if (ms < best[cores - 1])
+				best[cores - 1] = ms;
+		}
+	}
+	SIM_setDecode(true);
+	// Both cores are threads here, they only run side by side with more than one host CPU
+	printf("banded scene host time: 1 core %.2f ms, 2 cores %.2f ms, %.2fx on %ld host CPUs\n", best[0], best[1],
+		   best[0] / best[1], sysconf(_SC_NPROCESSORS_ONLN));
+}
+#endif
+
+#ifdef USE_RENDER_QUEUE
+// The dashboard posted from this core and drawn by the render core
+static void benchDashboardQueued()
+{
+	GFX_startRenderCore();
+	drawDashboard();
+	GFX_waitFence(GFX_fence());
+	GFX_stopRenderCore();
+}
+
+static void drawQueuedLabelBoxes(const char *name)
+{
+	if (!hasFrameBuffer())
+		printf("framebuffer lost in %s\n", name);
+	GFX_fillRect(30, 55, 360, 110, black);
+	drawLabelBoxes();
+	GFX_flush();
+}
+
+// The label boxes drawn by the render core into a framebuffer created before
+// it starts and deleted after it stops, the frame of label_boxes_framebuf
+static void benchQueuedFramebuf()
+{
+	GFX_createFramebuf(30, 55, 360, 110);
+	GFX_startRenderCore();
+	drawQueuedLabelBoxes("queued_framebuf");
+	GFX_stopRenderCore();
+	GFX_destroyFramebuf();
+}
+
+// The same with the framebuffer created through the queue
+static void benchQueuedFramebufPosted()
+{
+	GFX_startRenderCore();
+	GFX_createFramebuf(30, 55, 360, 110);
+	drawQueuedLabelBoxes("queued_framebuf_posted");
+	GFX_stopRenderCore();
+	GFX_destroyFramebuf();
+}
+#endif
+
+struct BenchCase
+{
+	const char *name;
+	void (*run)();
+};
+
+static const struct BenchCase cases[] = {
+	{"fillRect_small", benchFillRectSmall},
+	{"fillRect_large", benchFillRectLarge},
+	{"clearScreen", benchClearScreen},
+	{"drawPixel", benchDrawPixel},
+	{"drawLine", benchDrawLine},
+	{"fastHVLine", benchFastLines},
+	{"drawRect", benchDrawRect},
+	{"drawCircle", benchDrawCircle},
+	{"fillCircle", benchFillCircle},
+	{"fillTriangle", benchFillTriangle},
+	{"fillRoundedRect", benchFillRoundedRect},
+	{"drawChar_1", benchDrawChar1},
+	{"drawChar_2", benchDrawChar2},
+	{"drawChar_4", benchDrawChar4},
+	{"scaled_text", benchScaledText},
+	{"printf", benchPrintf},
+	{"printf_formats", benchPrintfFormats},
+	{"snprintf_formats", benchSnprintfFormats},
+	{"printFixed", benchPrintFixed},
+	{"printFixed_printf", benchPrintFixedPrintf},
+	{"label_clear", benchLabelClear},
+	{"label_boxes", benchLabelBoxes},
+	{"label_boxes_framebuf", benchLabelBoxesFramebuf},
+	{"icons_direct", benchIconsDirect},
+	{"icons_framebuf", benchIconsFramebuf},
+	{"counter_direct", benchCounterDirect},
+	{"counter_framebuf", benchCounterFramebuf},
+	{"wrap_direct", benchWrapDirect},
+	{"wrap_framebuf", benchWrapFramebuf},
+	{"widget_direct", benchWidgetDirect},
+	{"widget_framebuf", benchWidgetFramebuf},
+	{"widget_doublebuf", benchWidgetDoubleBuf},
+#ifdef USE_RGB565_FRAMEBUF
+	{"widget_565", benchWidget565},
+	{"wide_565", benchWide565},
+	{"wide_direct", benchWideDirect},
+#endif
+	{"dashboard_direct", benchDashboardDirect},
+	{"restart_warm", benchRestartWarm},
+#ifdef USE_INDEXED_FRAMEBUF
+	{"dashboard_8bit", benchDashboardIndexed},
+#endif
+#ifdef USE_RGB111_FRAMEBUF
+	{"dashboard_3bit", benchDashboard3Bit},
+	{"direct_3bit", benchDirect3Bit},
+#endif
+	{"term_update", benchTermUpdate},
+	{"term_full", benchTermFull},
+#ifdef USE_SCROLL_CONSOLE
+	{"console_scroll", benchConsoleScroll},
+	{"console_redraw", benchConsoleRedraw},
+#endif
+#ifdef USE_DISPLAY_LIST
+	{"dashboard_banded", benchDashboardBanded},
+	{"label_boxes_frame", benchLabelBoxesFrame},
+	{"icons_frame", benchIconsFrame},
+	{"status_full", benchStatusFull},
+	{"status_partial", benchStatusPartial},
+#ifdef USE_TILE_HASH
+	{"dashboard_tiles", benchDashboardTiles},
+	{"tiles_rotate", benchTilesRotate},
+	{"tiles_fresh", benchTilesFresh},
+#endif
+#ifdef USE_DIRTY_RECTS
+	{"dashboard_dirty", benchDashboardDirty},
+	{"dirty_rotate", benchDirtyRotate},
+#endif
+#endif
+#ifdef USE_RENDER_QUEUE
+	{"dashboard_queued", benchDashboardQueued},
+	{"queued_framebuf", benchQueuedFramebuf},
+	{"queued_framebuf_posted", benchQueuedFramebufPosted},
+#endif
+#ifdef USE_PARALLEL_BANDS
+	{"scene_1core", benchSceneOneCore},
+	{"scene_2cores", benchSceneTwoCores},
+#endif
+};
+
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+struct BenchResult
+{
+	struct SIM_Stats stats;
+	uint32_t mallocs;
+	uint32_t frees;
+	uint32_t framebufPeak;
+	uint32_t hash;
+#ifdef USE_STATS
+	struct LCD_Stats lcd;
+#endif
+};
+
+static struct BenchResult runCase(const struct BenchCase *c)
+{
+	struct BenchResult r;
+
+#ifdef USE_SCROLL_CONSOLE
+	GFX_stopConsole(); // Left running by the last case
+#endif
+	GFX_resetClip();
+	SIM_reset();
+	SIM_setTrace(false);
+	LCD_initDisplay();
+	LCD_setRotation(1);
+	GFX_setFont(NULL);
+	GFX_setClearColor(black);
+	GFX_clearScreen();
+
+	SIM_resetStats();
+#ifdef USE_STATS
+	LCD_resetStats();
+#endif
+	mallocs = frees = 0;
+	GFX_resetFramebufHighWater();
+	c->run();
+	r.stats = SIM_getStats();
+#ifdef USE_STATS
+	LCD_getStats(&r.lcd);
+#endif
+	r.mallocs = mallocs;
+	r.frees = frees;
+	r.framebufPeak = GFX_getFramebufHighWater();
+	r.hash = SIM_hashFrame();
+	return r;
+}
+
+// Simulated time from power-up to the display being ready: the init's waits
+// and its time on the wire
+static void printStartupTime()
+{
+	SIM_reset();
+	SIM_setTrace(false);
+	LCD_initDisplay();
+	struct SIM_Stats cold = SIM_getStats();
+	SIM_resetStats();
+	LCD_initDisplayWarm(); // The panel kept its configuration
+	struct SIM_Stats warm = SIM_getStats();
+	printf("startup: cold %llu bytes, %.2f ms, warm %llu bytes, %.2f ms\n",
+		   (unsigned long long)cold.bytes, cold.sleepTimeUs / 1e3 + cold.wireTimeNs / 1e6,
+		   (unsigned long long)warm.bytes, warm.sleepTimeUs / 1e3 + warm.wireTimeNs / 1e6);
+}
+
+struct Baseline
+{
+	char name[32];
+	uint32_t hash;
+	unsigned long long bytes;
+};
+
+static int readBaseline(const char *path, struct Baseline *b, int max)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	int n = 0;
+	while (n < max && fscanf(f, "%31s %x %llu", b[n].name, &b[n].hash, &b[n].bytes) == 3)
+		n++;
+	fclose(f);
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	const char *writePath = NULL;
+	const char *checkPath = NULL;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "--write"))
+			writePath = argv[i + 1];
+		else if (!strcmp(argv[i], "--check"))
+			checkPath = argv[i + 1];
+	}
+
+	struct Baseline baseline[64];
+	int nbaseline = 0;
+	if (checkPath != NULL)
+	{
+		nbaseline = readBaseline(checkPath, baseline, 64);
+		if (nbaseline < 0)
+		{
+			fprintf(stderr, "cannot read %s\n", checkPath);
+			return 2;
+		}
+	}
+
+	FILE *out = NULL;
+	if (writePath != NULL && (out = fopen(writePath, "w")) == NULL)
+	{
+		fprintf(stderr, "cannot write %s\n", writePath);
+		return 2;
+	}
+
+	printf("%-16s %10s %8s %7s %7s %8s %6s %8s %10s  %s\n", "case", "bytes", "windows", "ramwr", "cs", "format",
+		   "malloc", "fb peak", "wire ms", "frame");
+	int failures = 0;
+	for (unsigned int i = 0; i < NUM_CASES; i++)
+	{
+		struct BenchResult r = runCase(&cases[i]);
+		const struct SIM_Stats *s = &r.stats;
+		printf("%-16s %10llu %8u %7u %7u %8u %6u %8u %10.3f  %08x", cases[i].name, (unsigned long long)s->bytes,
+			   s->caset + s->paset, s->ramwr, s->csSelects, s->setFormat, r.mallocs, r.framebufPeak,
+			   s->wireTimeNs / 1e6, r.hash);
+		if (r.mallocs != r.frees)
+			printf("  LEAK %u", r.mallocs - r.frees);
+		if (s->busyToggles)
+		{
+			// CS or D/C changed while a DMA transfer was still on the wire
+			printf("  BUSY TOGGLES %u", s->busyToggles);
+			failures++;
+		}
+#ifdef USE_STATS
+		// The driver's own counters have to agree with what the panel saw
+		if (r.lcd.bytes != s->bytes || r.lcd.ramwrBursts != s->ramwr ||
+			r.lcd.pixelsWritePixel + r.lcd.pixelsBitmap + r.lcd.pixelsFill != s->pixels ||
+			r.lcd.framebufMallocs != r.lcd.framebufFrees)
+		{
+			printf("  LCD_STATS MISMATCH");
+			failures++;
+		}
+#endif
+
+		for (int j = 0; j < nbaseline; j++)
+		{
+			if (strcmp(baseline[j].name, cases[i].name))
+				continue;
+			if (baseline[j].hash != r.hash)
+			{
+				printf("  FRAME CHANGED (was %08x)", baseline[j].hash);
+				failures++;
+			}
+			if (s->bytes > baseline[j].bytes)
+			{
+				printf("  MORE BYTES (was %llu)", baseline[j].bytes);
+				failures++;
+			}
+		}
+		printf("\n");
+
+		if (out != NULL)
+			fprintf(out, "%s %08x %llu\n", cases[i].name, r.hash, (unsigned long long)s->bytes);
+	}
+
+	if (out != NULL)
+		fclose(out);
+#ifdef USE_PARALLEL_BANDS
+	printRasterScaling();
+#endif
+	printStartupTime();
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,708 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ili9488_sim.h"
+
+// Command set understood by the model, see ili9488.h for the full list
+#define CMD_SWRESET 0x01
+#define CMD_SLPIN 0x10
+#define CMD_SLPOUT 0x11
+#define CMD_PTLON 0x12
+#define CMD_NORON 0x13
+#define CMD_INVOFF 0x20
+#define CMD_INVON 0x21
+#define CMD_DISPOFF 0x28
+#define CMD_DISPON 0x29
+#define CMD_CASET 0x2A
+#define CMD_PASET 0x2B
+#define CMD_RAMWR 0x2C
+#define CMD_VSCRDEF 0x33
+#define CMD_MADCTL 0x36
+#define CMD_VSCRSADD 0x37
+#define CMD_IDMOFF 0x38
+#define CMD_IDMON 0x39
+#define CMD_PTLAR 0x30
+#define CMD_COLMOD 0x3A
+#define CMD_RAMWRC 0x3C
+
+#define MAD_MY 0x80
+#define MAD_MX 0x40
+#define MAD_MV 0x20
+
+static struct
+{
+	uint16_t pinCS;
+	uint16_t pinDC;
+	int16_t pinRST;
+	bool cs;
+	bool dc;
+
+	uint8_t gram[SIM_PANEL_HEIGHT][SIM_PANEL_WIDTH][3]; ///< RGB666, 6 bits left aligned
+
+	uint8_t cmd;		///< Command currently receiving parameters
+	uint8_t params[16]; ///< Parameters received for it so far
+	uint8_t nparams;
+
+	uint8_t madctl;
+	uint8_t colmod;
+	bool sleeping;
+	bool displayOn;
+	bool inverted;
+
+	uint16_t tfa, vsa, bfa; ///< Vertical scrolling areas (VSCRDEF), in memory rows
+	uint16_t vsp;			///< Memory row shown first in the scrolling area (VSCRSADD)
+	bool scrolling;			///< VSCRSADD received and not left with NORON or PTLON
+	uint16_t psr, per;		///< Rows shown in partial mode (PTLAR)
+	bool partial;			///< PTLON, rows outside of psr..per are black
+	bool idle;				///< IDMON, only the top bit of each channel is shown
+
+	uint16_t sc, ec; ///< Column window
+	uint16_t sp, ep; ///< Page window
+	uint16_t col;	 ///< Address counter
+	uint16_t page;
+	bool writing; ///< RAMWR accepts pixel data
+	uint8_t pix[3];
+	uint8_t npix;
+
+	uint32_t shift; ///< Bits clocked in that don't make up a whole byte yet
+	uint8_t shiftBits;
+
+	uint64_t clockNs;	  ///< Simulated time, advanced by blocking writes and sleeps
+	uint64_t dmaUntilNs; ///< When the last DMA frame leaves the wire
+	uint64_t sleepNs;
+	struct SIM_Stats stats;
+
+	bool skipDecode; ///< Frames only take time, see SIM_setDecode
+	bool trace;
+	struct SIM_Event *events;
+	uint32_t nevents;
+	uint32_t capevents;
+} sim = {
+	.pinCS = 17,
+	.pinDC = 20,
+	.pinRST = 16,
+	.cs = true,
+	.dc = true,
+	.ec = SIM_PANEL_WIDTH - 1,
+	.ep = SIM_PANEL_HEIGHT - 1,
+	.sleeping = true,
+	.trace = true,
+};
+
+static void record(uint8_t kind, uint8_t value)
+{
+	if (!sim.trace)
+		return;
+	if (sim.nevents == sim.capevents)
+	{
+		uint32_t cap = sim.capevents ? sim.capevents * 2 : 4096;
+		struct SIM_Event *ev = realloc(sim.events, cap * sizeof(*ev));
+		if (ev == NULL)
+			return;
+		sim.events = ev;
+		sim.capevents = cap;
+	}
+	sim.events[sim.nevents].kind = kind;
+	sim.events[sim.nevents].value = value;
+	sim.nevents++;
+}
+
+static void resetRegisters()
+{
+	sim.madctl = 0;
+	sim.colmod = 0x66;
+	sim.sleeping = true;
+	sim.displayOn = false;
+	sim.inverted = false;
+	sim.tfa = 0;
+	sim.vsa = SIM_PANEL_HEIGHT;
+	sim.bfa = 0;
+	sim.vsp = 0;
+	sim.scrolling = false;
+	sim.psr = 0;
+	sim.per = SIM_PANEL_HEIGHT - 1;
+	sim.partial = false;
+	sim.idle = false;
+	sim.sc = 0;
+	sim.ec = SIM_PANEL_WIDTH - 1;
+	sim.sp = 0;
+	sim.ep = SIM_PANEL_HEIGHT - 1;
+	sim.writing = false;
+	sim.npix = 0;
+}
+
+// Source bytes of a DMA transfer are only read when the transfer completes,
+// anything that must come after them on the wire settles it first
+static void (*dmaSettle)(void);
+
+static void settleDMA()
+{
+	if (dmaSettle != NULL)
+		dmaSettle();
+}
+
+void SIM_setDmaSettle(void (*settle)(void))
+{
+	dmaSettle = settle;
+}
+
+void SIM_attach(uint16_t cs, uint16_t dc, int16_t rst)
+{
+	sim.pinCS = cs;
+	sim.pinDC = dc;
+	sim.pinRST = rst;
+}
+
+void SIM_reset()
+{
+	settleDMA();
+	memset(sim.gram, 0, sizeof(sim.gram));
+	resetRegisters();
+	sim.cs = true;
+	sim.dc = true;
+	sim.cmd = 0;
+	sim.nparams = 0;
+	SIM_resetStats();
+	SIM_clearTrace();
+}
+
+void SIM_resetStats()
+{
+	settleDMA();
+	memset(&sim.stats, 0, sizeof(sim.stats));
+	sim.sleepNs = 0;
+}
+
+struct SIM_Stats SIM_getStats()
+{
+	settleDMA();
+	struct SIM_Stats s = sim.stats;
+	s.sleepTimeUs = sim.sleepNs / 1000;
+	return s;
+}
+
+void SIM_setDecode(bool enable)
+{
+	sim.skipDecode = !enable;
+}
+
+bool SIM_decoding()
+{
+	return !sim.skipDecode;
+}
+
+void SIM_setTrace(bool enable)
+{
+	sim.trace = enable;
+}
+
+void SIM_clearTrace()
+{
+	sim.nevents = 0;
+}
+
+const struct SIM_Event *SIM_getTrace(uint32_t *count)
+{
+	settleDMA();
+	*count = sim.nevents;
+	return sim.events;
+}
+
+void SIM_writeTrace(FILE *f)
+{
+	settleDMA();
+	uint8_t run = 0;
+	for (uint32_t i = 0; i < sim.nevents; i++)
+	{
+		const struct SIM_Event *e = &sim.events[i];
+		if (e->kind == SIM_EV_BYTE)
+		{
+			if (run == 16)
+			{
+				fputc('\n', f);
+				run = 0;
+			}
+			fprintf(f, run ? " %02X" : "%02X", e->value);
+			run++;
+			continue;
+		}
+		if (run)
+		{
+			fputc('\n', f);
+			run = 0;
+		}
+		switch (e->kind)
+		{
+		case SIM_EV_CS:
+			fprintf(f, "CS %u\n", e->value);
+			break;
+		case SIM_EV_DC:
+			fprintf(f, "DC %u\n", e->value);
+			break;
+		case SIM_EV_FORMAT:
+			fprintf(f, "FMT %u\n", e->value);
+			break;
+		}
+	}
+	if (run)
+		fputc('\n', f);
+}
+
+uint16_t SIM_getWidth()
+{
+	return (sim.madctl & MAD_MV) ? SIM_PANEL_HEIGHT : SIM_PANEL_WIDTH;
+}
+
+uint16_t SIM_getHeight()
+{
+	return (sim.madctl & MAD_MV) ? SIM_PANEL_WIDTH : SIM_PANEL_HEIGHT;
+}
+
+uint8_t SIM_getMadctl()
+{
+	return sim.madctl;
+}
+
+uint8_t SIM_getColmod()
+{
+	return sim.colmod;
+}
+
+// Maps a column/page address to its GRAM cell under the current MADCTL,
+// returns NULL when it falls outside the panel
+static uint8_t *gramCell(uint16_t col, uint16_t page)
+{
+	uint16_t x = col;
+	uint16_t y = page;
+	if (sim.madctl & MAD_MV)
+	{
+		x = page;
+		y = col;
+	}
+	if (x >= SIM_PANEL_WIDTH || y >= SIM_PANEL_HEIGHT)
+		return NULL;
+	if (sim.madctl & MAD_MX)
+		x = SIM_PANEL_WIDTH - 1 - x;
+	if (sim.madctl & MAD_MY)
+		y = SIM_PANEL_HEIGHT - 1 - y;
+	return sim.gram[y][x];
+}
+
+// Like gramCell, but for the cell the panel shows there: rows in the
+// scrolling area come from VSCRSADD on, wrapping within the area
+static const uint8_t *shownCell(uint16_t col, uint16_t page)
+{
+	const uint8_t *p = gramCell(col, page);
+	if (p == NULL || !sim.scrolling || sim.vsa == 0 || sim.tfa + sim.vsa > SIM_PANEL_HEIGHT)
+		return p;
+	uint16_t row = (p - &sim.gram[0][0][0]) / sizeof(sim.gram[0]);
+	if (row < sim.tfa || row >= sim.tfa + sim.vsa)
+		return p;
+	uint16_t start = sim.vsp >= sim.tfa && sim.vsp < sim.tfa + sim.vsa ? sim.vsp - sim.tfa : 0;
+	uint16_t shown = sim.tfa + (row - sim.tfa + start) % sim.vsa;
+	return p + (shown - row) * (int)sizeof(sim.gram[0]);
+}
+
+// The colour the panel shows at a cell, 6 bits left aligned. Partial mode
+// blanks the rows outside of its area, idle mode keeps the top bit.
+static void shownColor(uint16_t col, uint16_t page, uint8_t rgb[3])
+{
+	const uint8_t *p = shownCell(col, page);
+	const uint8_t *cell = gramCell(col, page);
+	memset(rgb, 0, 3);
+	if (p == NULL)
+		return;
+	if (sim.partial)
+	{
+		uint16_t row = (cell - &sim.gram[0][0][0]) / sizeof(sim.gram[0]);
+		bool inside = sim.psr <= sim.per ? row >= sim.psr && row <= sim.per : row >= sim.psr || row <= sim.per;
+		if (!inside)
+			return;
+	}
+	for (uint8_t i = 0; i < 3; i++)
+		rgb[i] = sim.idle ? (p[i] & 0x80 ? 0xFC : 0) : p[i];
+}
+
+void SIM_getPixel(uint16_t x, uint16_t y, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+	uint8_t p[3];
+	settleDMA();
+	shownColor(x, y, p);
+	*r = p[0] | (p[0] >> 6);
+	*g = p[1] | (p[1] >> 6);
+	*b = p[2] | (p[2] >> 6);
+}
+
+uint32_t SIM_hashFrame()
+{
+	settleDMA();
+	uint32_t h = 2166136261u;
+	for (uint16_t y = 0; y < SIM_getHeight(); y++)
+	{
+		for (uint16_t x = 0; x < SIM_getWidth(); x++)
+		{
+			uint8_t p[3];
+			shownColor(x, y, p);
+			for (uint8_t i = 0; i < 3; i++)
+			{
+				h ^= p[i];
+				h *= 16777619u;
+			}
+		}
+	}
+	return h;
+}
+
+bool SIM_dumpPPM(const char *path)
+{
+	settleDMA();
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+		return false;
+	uint16_t w = SIM_getWidth();
+	uint16_t h = SIM_getHeight();
+	fprintf(f, "P6\n%u %u\n255\n", w, h);
+	for (uint16_t y = 0; y < h; y++)
+	{
+		for (uint16_t x = 0; x < w; x++)
+		{
+			uint8_t rgb[3];
+			SIM_getPixel(x, y, &rgb[0], &rgb[1], &rgb[2]);
+			fwrite(rgb, 1, 3, f);
+		}
+	}
+	return fclose(f) == 0;
+}
+
+static void advanceCounter()
+{
+	if (++sim.col > sim.ec)
+	{
+		sim.col = sim.sc;
+		if (++sim.page > sim.ep)
+			sim.page = sim.sp;
+	}
+}
+
+static void storePixel(const uint8_t *rgb)
+{
+	uint8_t *p = gramCell(sim.col, sim.page);
+	if (p != NULL)
+	{
+		p[0] = rgb[0] & 0xFC;
+		p[1] = rgb[1] & 0xFC;
+		p[2] = rgb[2] & 0xFC;
+	}
+	sim.stats.pixels++;
+	advanceCounter();
+}
+
+// One pixel of the 3-bit interface format, a bit each for R, G and B
+static void storePixel3(uint8_t bits)
+{
+	const uint8_t rgb[3] = {bits & 4 ? 0xFC : 0, bits & 2 ? 0xFC : 0, bits & 1 ? 0xFC : 0};
+	storePixel(rgb);
+}
+
+static void pixelByte(uint8_t b)
+{
+	sim.stats.pixelBytes++;
+	if ((sim.colmod & 0x07) == 0x01)
+	{
+		// Two pixels per byte, D5-D3 then D2-D0
+		storePixel3(b >> 3);
+		storePixel3(b);
+		return;
+	}
+	sim.pix[sim.npix++] = b;
+	if (sim.npix == 3)
+	{
+		storePixel(sim.pix);
+		sim.npix = 0;
+	}
+}
+
+static void command(uint8_t c)
+{
+	sim.stats.commands++;
+	sim.cmd = c;
+	sim.nparams = 0;
+	sim.writing = false;
+	sim.npix = 0;
+
+	switch (c)
+	{
+	case CMD_SWRESET:
+		resetRegisters();
+		break;
+	case CMD_SLPIN:
+		sim.sleeping = true;
+		break;
+	case CMD_SLPOUT:
+		sim.sleeping = false;
+		break;
+	case CMD_INVOFF:
+		sim.inverted = false;
+		break;
+	case CMD_INVON:
+		sim.inverted = true;
+		break;
+	case CMD_DISPOFF:
+		sim.displayOn = false;
+		break;
+	case CMD_DISPON:
+		sim.displayOn = true;
+		break;
+	case CMD_PTLON:
+		sim.scrolling = false;
+		sim.partial = true;
+		break;
+	case CMD_NORON:
+		sim.scrolling = false;
+		sim.partial = false;
+		break;
+	case CMD_IDMOFF:
+		sim.idle = false;
+		break;
+	case CMD_IDMON:
+		sim.idle = true;
+		break;
+	case CMD_CASET:
+		sim.stats.caset++;
+		break;
+	case CMD_PASET:
+		sim.stats.paset++;
+		break;
+	case CMD_RAMWR:
+		sim.stats.ramwr++;
+		sim.col = sim.sc;
+		sim.page = sim.sp;
+		sim.writing = true;
+		break;
+	case CMD_RAMWRC:
+		sim.writing = true;
+		break;
+	}
+}
+
+static void data(uint8_t b)
+{
+	if (sim.writing)
+	{
+		pixelByte(b);
+		return;
+	}
+	if (sim.nparams < sizeof(sim.params))
+		sim.params[sim.nparams] = b;
+	sim.nparams++;
+
+	switch (sim.cmd)
+	{
+	case CMD_CASET:
+		if (sim.nparams == 4)
+		{
+			sim.sc = (sim.params[0] << 8) | sim.params[1];
+			sim.ec = (sim.params[2] << 8) | sim.params[3];
+		}
+		break;
+	case CMD_PASET:
+		if (sim.nparams == 4)
+		{
+			sim.sp = (sim.params[0] << 8) | sim.params[1];
+			sim.ep = (sim.params[2] << 8) | sim.params[3];
+		}
+		break;
+	case CMD_MADCTL:
+		if (sim.nparams == 1)
+			sim.madctl = b;
+		break;
+	case CMD_COLMOD:
+		if (sim.nparams == 1)
+			sim.colmod = b;
+		break;
+	case CMD_VSCRDEF:
+		if (sim.nparams == 6)
+		{
+			sim.tfa = (sim.params[0] << 8) | sim.params[1];
+			sim.vsa = (sim.params[2] << 8) | sim.params[3];
+			sim.bfa = (sim.params[4] << 8) | sim.params[5];
+		}
+		break;
+	case CMD_PTLAR:
+		if (sim.nparams == 4)
+		{
+			sim.psr = (sim.params[0] << 8) | sim.params[1];
+			sim.per = (sim.params[2] << 8) | sim.params[3];
+		}
+		break;
+	case CMD_VSCRSADD:
+		if (sim.nparams == 2)
+		{
+			sim.vsp = (sim.params[0] << 8) | sim.params[1];
+			sim.scrolling = true;
+		}
+		break;
+	}
+}
+
+static void wireByte(uint8_t b)
+{
+	sim.stats.bytes++;
+	if (sim.cs)
+	{
+		sim.stats.idleBytes++;
+		return;
+	}
+	record(SIM_EV_BYTE, b);
+	if (!sim.dc)
+	{
+		sim.stats.cmdBytes++;
+		command(b);
+	}
+	else
+	{
+		sim.stats.dataBytes++;
+		data(b);
+	}
+}
+
+void SIM_gpioPut(unsigned int gpio, bool value)
+{
+	settleDMA();
+	if ((gpio == sim.pinCS || gpio == sim.pinDC) && SIM_dmaBusy())
+		sim.stats.busyToggles++;
+
+	if (gpio == sim.pinCS)
+	{
+		if (value == sim.cs)
+			return;
+		sim.cs = value;
+		sim.shiftBits = 0;
+		if (!value)
+			sim.stats.csSelects++;
+		record(SIM_EV_CS, value);
+	}
+	else if (gpio == sim.pinDC)
+	{
+		if (value == sim.dc)
+			return;
+		sim.dc = value;
+		sim.stats.dcToggles++;
+		record(SIM_EV_DC, value);
+	}
+	else if (sim.pinRST >= 0 && gpio == (unsigned int)sim.pinRST && !value)
+	{
+		resetRegisters();
+	}
+}
+
+void SIM_spiFormat(unsigned int bits)
+{
+	settleDMA();
+	sim.stats.setFormat++;
+	record(SIM_EV_FORMAT, (uint8_t)bits);
+}
+
+static uint64_t frameNs(unsigned int bits, uint32_t baudrate)
+{
+	if (!baudrate)
+		return 0;
+	return (uint64_t)bits * 1000000000u / baudrate;
+}
+
+// The panel sees a plain bit stream, frames of any size are regrouped into bytes
+static void frame(unsigned int bits, uint16_t value)
+{
+	sim.shift = (sim.shift << bits) | (value & ((1u << bits) - 1));
+	sim.shiftBits += bits;
+	while (sim.shiftBits >= 8)
+	{
+		sim.shiftBits -= 8;
+		wireByte((sim.shift >> sim.shiftBits) & 0xFF);
+	}
+}
+
+void SIM_spiWrite()
+{
+	sim.stats.spiWrites++;
+}
+
+void SIM_spiSkip(unsigned int bits, uint32_t baudrate, uint32_t frames)
+{
+	// A blocking write queues behind any DMA still feeding the FIFO
+	settleDMA();
+	uint64_t ns = frameNs(bits, baudrate) * frames;
+	if (sim.clockNs < sim.dmaUntilNs)
+		sim.clockNs = sim.dmaUntilNs;
+	sim.clockNs += ns;
+	sim.stats.wireTimeNs += ns;
+	sim.stats.bytes += (uint64_t)bits * frames / 8;
+}
+
+void SIM_spiFrame(unsigned int bits, uint32_t baudrate, uint16_t value)
+{
+	// A blocking write queues behind any DMA still feeding the FIFO
+	settleDMA();
+	uint64_t ns = frameNs(bits, baudrate);
+	if (sim.clockNs < sim.dmaUntilNs)
+		sim.clockNs = sim.dmaUntilNs;
+	sim.clockNs += ns;
+	sim.stats.wireTimeNs += ns;
+	frame(bits, value);
+}
+
+void SIM_dmaTransfer()
+{
+	sim.stats.dmaTransfers++;
+}
+
+void SIM_dmaSkip(unsigned int bits, uint32_t baudrate, uint32_t frames)
+{
+	uint64_t ns = frameNs(bits, baudrate) * frames;
+	if (sim.dmaUntilNs < sim.clockNs)
+		sim.dmaUntilNs = sim.clockNs;
+	sim.dmaUntilNs += ns;
+	sim.stats.wireTimeNs += ns;
+	sim.stats.bytes += (uint64_t)bits * frames / 8;
+}
+
+void SIM_dmaQueue(unsigned int bits, uint32_t baudrate, uint32_t frames)
+{
+	// DMA frames occupy the wire from the trigger on, the CPU clock moves on
+	// when somebody waits for them
+	uint64_t ns = frameNs(bits, baudrate) * frames;
+	if (sim.dmaUntilNs < sim.clockNs)
+		sim.dmaUntilNs = sim.clockNs;
+	sim.dmaUntilNs += ns;
+	sim.stats.wireTimeNs += ns;
+}
+
+void SIM_dmaFrame(unsigned int bits, uint16_t value)
+{
+	frame(bits, value);
+}
+
+bool SIM_dmaBusy()
+{
+	if (sim.clockNs < sim.dmaUntilNs)
+		return true;
+	settleDMA();
+	return false;
+}
+
+void SIM_dmaWait()
+{
+	if (sim.clockNs < sim.dmaUntilNs)
+		sim.clockNs = sim.dmaUntilNs;
+	settleDMA();
+}
+
+void SIM_sleepUs(uint64_t us)
+{
+	sim.sleepNs += us * 1000;
+	sim.clockNs += us * 1000;
+}
+
+uint64_t SIM_timeUs()
+{
+	return sim.clockNs / 1000;
+}
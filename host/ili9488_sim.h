@@ -0,0 +1,105 @@
+#ifndef ILI9488_SIM_H
+#define ILI9488_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_PANEL_WIDTH 320  ///< Native (MADCTL = 0) GRAM width
+#define SIM_PANEL_HEIGHT 480 ///< Native (MADCTL = 0) GRAM height
+
+/// Kinds of entries in the wire trace
+enum SIM_EventKind
+{
+	SIM_EV_CS,	   ///< Chip select level changed, value = new level
+	SIM_EV_DC,	   ///< D/C level changed, value = new level (0 = command)
+	SIM_EV_BYTE,   ///< Byte clocked out while the panel is selected
+	SIM_EV_FORMAT, ///< spi_set_format, value = frame size in bits
+};
+
+struct SIM_Event
+{
+	uint8_t kind;
+	uint8_t value;
+};
+
+/// Counters collected by the simulator since the last SIM_resetStats()
+struct SIM_Stats
+{
+	uint64_t bytes;		  ///< All bytes clocked out on the bus
+	uint64_t cmdBytes;	  ///< Bytes sent with D/C low
+	uint64_t dataBytes;	  ///< Bytes sent with D/C high
+	uint64_t pixelBytes;  ///< Data bytes that went into GRAM
+	uint64_t pixels;	  ///< Pixels written to GRAM
+	uint64_t idleBytes;	  ///< Bytes clocked out with CS high (lost)
+	uint64_t wireTimeNs;  ///< Time the bus was busy at the configured clock
+	uint64_t sleepTimeUs; ///< Time spent in sleep_ms()/sleep_us()
+	uint32_t caset;		  ///< CASET commands
+	uint32_t paset;		  ///< PASET commands
+	uint32_t ramwr;		  ///< RAMWR commands
+	uint32_t commands;	  ///< All commands
+	uint32_t csSelects;	  ///< CS falling edges
+	uint32_t dcToggles;	  ///< D/C transitions
+	uint32_t setFormat;	  ///< spi_set_format calls
+	uint32_t spiWrites;	  ///< spi_write_blocking/spi_write16_blocking calls
+	uint32_t dmaTransfers; ///< DMA transfers targeting the SPI data register
+	uint32_t busyToggles;  ///< CS or D/C changed while a DMA transfer was still on the wire
+};
+
+/// Tells the simulator which GPIOs the driver uses, defaults match ili9488.c
+void SIM_attach(uint16_t cs, uint16_t dc, int16_t rst);
+
+/// Power-on state: GRAM cleared to black, registers reset, trace and stats cleared
+void SIM_reset();
+
+void SIM_resetStats();
+struct SIM_Stats SIM_getStats();
+
+void SIM_setTrace(bool enable);
+/// For timing runs: with decoding off, SPI frames only take wire time and are counted as bytes, the panel ignores them
+void SIM_setDecode(bool enable);
+void SIM_clearTrace();
+const struct SIM_Event *SIM_getTrace(uint32_t *count);
+void SIM_writeTrace(FILE *f);
+
+/// Reads back the pixel the panel shows at logical coordinates under the current MADCTL and vertical scrolling, as 8-bit components
+void SIM_getPixel(uint16_t x, uint16_t y, uint8_t *r, uint8_t *g, uint8_t *b);
+uint16_t SIM_getWidth();
+uint16_t SIM_getHeight();
+uint8_t SIM_getMadctl();
+uint8_t SIM_getColmod();
+
+/// FNV-1a hash of the panel content in logical orientation
+uint32_t SIM_hashFrame();
+/// Writes the panel content in logical orientation as a binary PPM
+bool SIM_dumpPPM(const char *path);
+
+// Hooks used by the host pico-sdk stand-ins
+void SIM_gpioPut(unsigned int gpio, bool value);
+void SIM_spiFormat(unsigned int bits);
+void SIM_spiWrite();
+void SIM_spiFrame(unsigned int bits, uint32_t baudrate, uint16_t frame);
+void SIM_dmaTransfer();
+/// Accounts the wire time of a DMA transfer when it is triggered
+void SIM_dmaQueue(unsigned int bits, uint32_t baudrate, uint32_t frames);
+/// Decodes one frame of a queued DMA transfer once its source is consumed
+void SIM_dmaFrame(unsigned int bits, uint16_t frame);
+/// Called before anything that must follow pending DMA data on the wire
+void SIM_setDmaSettle(void (*settle)(void));
+bool SIM_decoding();
+void SIM_spiSkip(unsigned int bits, uint32_t baudrate, uint32_t frames);
+void SIM_dmaSkip(unsigned int bits, uint32_t baudrate, uint32_t frames);
+bool SIM_dmaBusy();
+void SIM_dmaWait();
+void SIM_sleepUs(uint64_t us);
+uint64_t SIM_timeUs();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
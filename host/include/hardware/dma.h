@@ -0,0 +1,81 @@
+#ifndef _HARDWARE_DMA_H
+#define _HARDWARE_DMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NUM_DMA_CHANNELS 12
+
+enum dma_channel_transfer_size
+{
+	DMA_SIZE_8 = 0,
+	DMA_SIZE_16 = 1,
+	DMA_SIZE_32 = 2
+};
+
+typedef struct
+{
+	enum dma_channel_transfer_size size;
+	bool read_increment;
+	bool write_increment;
+	unsigned int dreq;
+	unsigned int chain_to;
+	bool ring_write;
+	unsigned int ring_size_bits;
+	bool enable;
+} dma_channel_config;
+
+int dma_claim_unused_channel(bool required);
+void dma_channel_unclaim(unsigned int channel);
+dma_channel_config dma_channel_get_default_config(unsigned int channel);
+
+static inline void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size)
+{
+	c->size = size;
+}
+
+static inline void channel_config_set_read_increment(dma_channel_config *c, bool incr)
+{
+	c->read_increment = incr;
+}
+
+static inline void channel_config_set_write_increment(dma_channel_config *c, bool incr)
+{
+	c->write_increment = incr;
+}
+
+static inline void channel_config_set_dreq(dma_channel_config *c, unsigned int dreq)
+{
+	c->dreq = dreq;
+}
+
+static inline void channel_config_set_ring(dma_channel_config *c, bool write, unsigned int size_bits)
+{
+	c->ring_write = write;
+	c->ring_size_bits = size_bits;
+}
+
+static inline void channel_config_set_chain_to(dma_channel_config *c, unsigned int chain_to)
+{
+	c->chain_to = chain_to;
+}
+
+// Transfers run to completion as soon as they are triggered, so a channel is
+// never busy and waiting on it returns immediately
+void dma_channel_configure(unsigned int channel, const dma_channel_config *config, volatile void *write_addr,
+						   const volatile void *read_addr, unsigned int transfer_count, bool trigger);
+void dma_channel_set_read_addr(unsigned int channel, const volatile void *read_addr, bool trigger);
+void dma_channel_set_trans_count(unsigned int channel, uint32_t trans_count, bool trigger);
+void dma_channel_start(unsigned int channel);
+bool dma_channel_is_busy(unsigned int channel);
+void dma_channel_wait_for_finish_blocking(unsigned int channel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
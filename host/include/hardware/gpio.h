@@ -0,0 +1,31 @@
+#ifndef _HARDWARE_GPIO_H
+#define _HARDWARE_GPIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+
+enum gpio_function
+{
+	GPIO_FUNC_SPI = 1,
+	GPIO_FUNC_SIO = 5,
+	GPIO_FUNC_NULL = 0x1f,
+};
+
+void gpio_init(unsigned int gpio);
+void gpio_set_dir(unsigned int gpio, bool out);
+void gpio_set_function(unsigned int gpio, enum gpio_function fn);
+void gpio_put(unsigned int gpio, bool value);
+bool gpio_get(unsigned int gpio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
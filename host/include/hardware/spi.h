@@ -0,0 +1,81 @@
+#ifndef _HARDWARE_SPI_H
+#define _HARDWARE_SPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+	volatile uint32_t cr0;
+	volatile uint32_t cr1;
+	volatile uint32_t dr;
+	volatile uint32_t sr;
+} spi_hw_t;
+
+typedef struct spi_inst
+{
+	spi_hw_t hw;
+	unsigned int index;
+	unsigned int baudrate;
+	unsigned int data_bits;
+} spi_inst_t;
+
+extern spi_inst_t host_spi0;
+extern spi_inst_t host_spi1;
+
+#define spi0 (&host_spi0)
+#define spi1 (&host_spi1)
+#define spi_default spi0
+
+typedef enum
+{
+	SPI_CPHA_0 = 0,
+	SPI_CPHA_1 = 1
+} spi_cpha_t;
+
+typedef enum
+{
+	SPI_CPOL_0 = 0,
+	SPI_CPOL_1 = 1
+} spi_cpol_t;
+
+typedef enum
+{
+	SPI_LSB_FIRST = 0,
+	SPI_MSB_FIRST = 1
+} spi_order_t;
+
+unsigned int spi_init(spi_inst_t *spi, unsigned int baudrate);
+void spi_deinit(spi_inst_t *spi);
+unsigned int spi_set_baudrate(spi_inst_t *spi, unsigned int baudrate);
+unsigned int spi_get_baudrate(const spi_inst_t *spi);
+void spi_set_format(spi_inst_t *spi, unsigned int data_bits, spi_cpol_t cpol, spi_cpha_t cpha, spi_order_t order);
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len);
+int spi_write16_blocking(spi_inst_t *spi, const uint16_t *src, size_t len);
+bool spi_is_busy(const spi_inst_t *spi);
+
+static inline spi_hw_t *spi_get_hw(spi_inst_t *spi)
+{
+	return &spi->hw;
+}
+
+static inline unsigned int spi_get_index(const spi_inst_t *spi)
+{
+	return spi->index;
+}
+
+static inline unsigned int spi_get_dreq(spi_inst_t *spi, bool is_tx)
+{
+	return spi->index * 2 + (is_tx ? 16 : 17);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
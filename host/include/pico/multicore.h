@@ -0,0 +1,22 @@
+#ifndef _PICO_MULTICORE_H
+#define _PICO_MULTICORE_H
+
+#include "pico/stdlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Runs entry on a host thread standing in for core 1
+void multicore_launch_core1(void (*entry)(void));
+// Nothing to do, the thread of a previous launch ends when its entry returns
+void multicore_reset_core1(void);
+// The inter-core FIFOs, 8 words each way like on the RP2040
+void multicore_fifo_push_blocking(uint32_t data);
+uint32_t multicore_fifo_pop_blocking(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
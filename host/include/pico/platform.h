@@ -0,0 +1,29 @@
+#ifndef _PICO_PLATFORM_H
+#define _PICO_PLATFORM_H
+
+#include <sched.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The two cores are host threads, the one started by multicore_launch_core1
+// reports core 1
+extern __thread unsigned int host_core_num;
+
+static inline unsigned int get_core_num(void)
+{
+	return host_core_num;
+}
+
+// Spin loops give the other core's thread a chance, the host may have a single CPU
+static inline void tight_loop_contents(void)
+{
+	sched_yield();
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _PICO_STDLIB_H
+#define _PICO_STDLIB_H
+
+// Host stand-in for the pico-sdk header of the same name. Only the parts used
+// by the drivers in this repository are provided, see host/README.md
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "pico/platform.h"
+#include "pico/time.h"
+#include "hardware/gpio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef unsigned int uint;
+
+#define PICO_DEFAULT_SPI 0
+#define PICO_DEFAULT_SPI_SCK_PIN 18
+#define PICO_DEFAULT_SPI_TX_PIN 19
+#define PICO_DEFAULT_SPI_RX_PIN 16
+#define PICO_DEFAULT_SPI_CSN_PIN 17
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _PICO_TIME_H
+#define _PICO_TIME_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Time is simulated: sleeping advances the clock instead of blocking, and the
+// SPI model advances it by the wire time of every frame it clocks out
+void sleep_ms(uint32_t ms);
+void sleep_us(uint64_t us);
+uint64_t time_us_64(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,351 @@
+#include <string.h>
+#include <pthread.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/spi.h"
+#include "hardware/dma.h"
+#include "ili9488_sim.h"
+
+// Host implementations of the pico-sdk calls used by the drivers. GPIO and SPI
+// traffic is forwarded to the simulated panel in ili9488_sim.c
+
+spi_inst_t host_spi0 = {.index = 0, .data_bits = 8};
+spi_inst_t host_spi1 = {.index = 1, .data_bits = 8};
+
+static bool gpioLevel[32];
+
+__thread unsigned int host_core_num = 0;
+
+static void *core1Thread(void *entry)
+{
+	host_core_num = 1;
+	((void (*)(void))entry)();
+	return NULL;
+}
+
+void multicore_launch_core1(void (*entry)(void))
+{
+	pthread_t thread;
+	pthread_create(&thread, NULL, core1Thread, (void *)entry);
+	pthread_detach(thread);
+}
+
+void multicore_reset_core1(void)
+{
+}
+
+#define FIFO_DEPTH 8
+
+// One FIFO per core, holding the words sent to it
+static struct
+{
+	uint32_t data[FIFO_DEPTH];
+	uint32_t head, tail;
+} fifo[2];
+static pthread_mutex_t fifoLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fifoChanged = PTHREAD_COND_INITIALIZER;
+
+void multicore_fifo_push_blocking(uint32_t data)
+{
+	unsigned int to = host_core_num ^ 1;
+	pthread_mutex_lock(&fifoLock);
+	while (fifo[to].head - fifo[to].tail == FIFO_DEPTH)
+		pthread_cond_wait(&fifoChanged, &fifoLock);
+	fifo[to].data[fifo[to].head++ % FIFO_DEPTH] = data;
+	pthread_cond_broadcast(&fifoChanged);
+	pthread_mutex_unlock(&fifoLock);
+}
+
+uint32_t multicore_fifo_pop_blocking(void)
+{
+	unsigned int to = host_core_num;
+	pthread_mutex_lock(&fifoLock);
+	while (fifo[to].head == fifo[to].tail)
+		pthread_cond_wait(&fifoChanged, &fifoLock);
+	uint32_t data = fifo[to].data[fifo[to].tail++ % FIFO_DEPTH];
+	pthread_cond_broadcast(&fifoChanged);
+	pthread_mutex_unlock(&fifoLock);
+	return data;
+}
+
+void gpio_init(unsigned int gpio)
+{
+	(void)gpio;
+}
+
+void gpio_set_dir(unsigned int gpio, bool out)
+{
+	(void)gpio;
+	(void)out;
+}
+
+void gpio_set_function(unsigned int gpio, enum gpio_function fn)
+{
+	(void)gpio;
+	(void)fn;
+}
+
+void gpio_put(unsigned int gpio, bool value)
+{
+	if (gpio < 32)
+		gpioLevel[gpio] = value;
+	SIM_gpioPut(gpio, value);
+}
+
+bool gpio_get(unsigned int gpio)
+{
+	return gpio < 32 && gpioLevel[gpio];
+}
+
+void sleep_ms(uint32_t ms)
+{
+	SIM_sleepUs((uint64_t)ms * 1000);
+}
+
+void sleep_us(uint64_t us)
+{
+	SIM_sleepUs(us);
+}
+
+uint64_t time_us_64(void)
+{
+	return SIM_timeUs();
+}
+
+unsigned int spi_init(spi_inst_t *spi, unsigned int baudrate)
+{
+	spi->data_bits = 8;
+	return spi_set_baudrate(spi, baudrate);
+}
+
+void spi_deinit(spi_inst_t *spi)
+{
+	spi->baudrate = 0;
+}
+
+unsigned int spi_set_baudrate(spi_inst_t *spi, unsigned int baudrate)
+{
+	// Keep the requested clock so the wire time matches what the driver asked for
+	spi->baudrate = baudrate;
+	return baudrate;
+}
+
+unsigned int spi_get_baudrate(const spi_inst_t *spi)
+{
+	return spi->baudrate;
+}
+
+void spi_set_format(spi_inst_t *spi, unsigned int data_bits, spi_cpol_t cpol, spi_cpha_t cpha, spi_order_t order)
+{
+	(void)cpol;
+	(void)cpha;
+	(void)order;
+	spi->data_bits = data_bits;
+	SIM_spiFormat(data_bits);
+}
+
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len)
+{
+	SIM_spiWrite();
+	if (!SIM_decoding())
+	{
+		SIM_spiSkip(spi->data_bits, spi->baudrate, len);
+		return (int)len;
+	}
+	for (size_t i = 0; i < len; i++)
+		SIM_spiFrame(spi->data_bits, spi->baudrate, src[i]);
+	return (int)len;
+}
+
+int spi_write16_blocking(spi_inst_t *spi, const uint16_t *src, size_t len)
+{
+	SIM_spiWrite();
+	for (size_t i = 0; i < len; i++)
+		SIM_spiFrame(spi->data_bits, spi->baudrate, src[i]);
+	return (int)len;
+}
+
+bool spi_is_busy(const spi_inst_t *spi)
+{
+	(void)spi;
+	return SIM_dmaBusy();
+}
+
+static uint16_t dmaClaimed;
+
+static struct
+{
+	dma_channel_config config;
+	volatile void *write;
+	const volatile void *read;
+	uint32_t count;
+} dmaChan[NUM_DMA_CHANNELS];
+
+int dma_claim_unused_channel(bool required)
+{
+	for (unsigned int i = 0; i < NUM_DMA_CHANNELS; i++)
+	{
+		if (!(dmaClaimed & (1u << i)))
+		{
+			dmaClaimed |= 1u << i;
+			return (int)i;
+		}
+	}
+	(void)required;
+	return -1;
+}
+
+void dma_channel_unclaim(unsigned int channel)
+{
+	dmaClaimed &= ~(1u << channel);
+}
+
+dma_channel_config dma_channel_get_default_config(unsigned int channel)
+{
+	dma_channel_config c = {
+		.size = DMA_SIZE_32,
+		.read_increment = true,
+		.write_increment = false,
+		.dreq = 0x3f,
+		.chain_to = channel,
+		.ring_write = false,
+		.ring_size_bits = 0,
+		.enable = true,
+	};
+	return c;
+}
+
+static spi_inst_t *spiForAddress(volatile void *addr)
+{
+	if (addr == &host_spi0.hw.dr)
+		return &host_spi0;
+	if (addr == &host_spi1.hw.dr)
+		return &host_spi1;
+	return NULL;
+}
+
+// Address wrapping of DMA rings: only the low ring_bits of the address change
+static void *ringAdvance(const volatile void *addr, unsigned int size, unsigned int ringBits)
+{
+	uintptr_t a = (uintptr_t)addr;
+	if (!ringBits)
+		return (void *)(a + size);
+	uintptr_t mask = ((uintptr_t)1 << ringBits) - 1;
+	return (void *)((a & ~mask) | ((a + size) & mask));
+}
+
+// An SPI transfer only reads its source when it completes, so a buffer
+// rewritten while the transfer is in flight shows up on the panel
+static struct
+{
+	dma_channel_config config;
+	const volatile uint8_t *read;
+	uint32_t count;
+	unsigned int bits;
+} dmaPending;
+
+static void settleTransfer()
+{
+	const dma_channel_config *c = &dmaPending.config;
+	const unsigned int size = 1u << c->size;
+	const volatile uint8_t *src = dmaPending.read;
+	const uint32_t count = dmaPending.count;
+
+	dmaPending.count = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t v = 0;
+		memcpy(&v, (const void *)src, size);
+		// The SPI only takes the low data_bits of whatever is written to DR
+		SIM_dmaFrame(dmaPending.bits, (uint16_t)v);
+		if (c->read_increment)
+			src = ringAdvance(src, size, c->ring_size_bits && !c->ring_write ? c->ring_size_bits : 0);
+	}
+}
+
+static void runChannel(unsigned int channel)
+{
+	const dma_channel_config *c = &dmaChan[channel].config;
+	const unsigned int size = 1u << c->size;
+	const volatile uint8_t *src = dmaChan[channel].read;
+	volatile uint8_t *dst = dmaChan[channel].write;
+	spi_inst_t *spi = spiForAddress(dst);
+
+	if (spi != NULL)
+	{
+		SIM_dmaTransfer();
+		if (!SIM_decoding())
+		{
+			SIM_dmaSkip(spi->data_bits, spi->baudrate, dmaChan[channel].count);
+			dmaChan[channel].count = 0;
+			return;
+		}
+		// Whatever is still queued goes out before this transfer
+		SIM_setDmaSettle(settleTransfer);
+		settleTransfer();
+		SIM_dmaQueue(spi->data_bits, spi->baudrate, dmaChan[channel].count);
+		dmaPending.config = *c;
+		dmaPending.read = src;
+		dmaPending.count = dmaChan[channel].count;
+		dmaPending.bits = spi->data_bits;
+	}
+
+	for (uint32_t i = 0; i < dmaChan[channel].count; i++)
+	{
+		if (spi == NULL)
+		{
+			uint32_t v = 0;
+			memcpy(&v, (const void *)src, size);
+			memcpy((void *)dst, &v, size);
+		}
+		if (c->read_increment)
+			src = ringAdvance(src, size, c->ring_size_bits && !c->ring_write ? c->ring_size_bits : 0);
+		if (c->write_increment)
+			dst = ringAdvance(dst, size, c->ring_size_bits && c->ring_write ? c->ring_size_bits : 0);
+	}
+	dmaChan[channel].read = src;
+	dmaChan[channel].write = dst;
+	dmaChan[channel].count = 0;
+}
+
+void dma_channel_configure(unsigned int channel, const dma_channel_config *config, volatile void *write_addr,
+						   const volatile void *read_addr, unsigned int transfer_count, bool trigger)
+{
+	dmaChan[channel].config = *config;
+	dmaChan[channel].write = write_addr;
+	dmaChan[channel].read = read_addr;
+	dmaChan[channel].count = transfer_count;
+	if (trigger)
+		runChannel(channel);
+}
+
+void dma_channel_set_read_addr(unsigned int channel, const volatile void *read_addr, bool trigger)
+{
+	dmaChan[channel].read = read_addr;
+	if (trigger)
+		runChannel(channel);
+}
+
+void dma_channel_set_trans_count(unsigned int channel, uint32_t trans_count, bool trigger)
+{
+	dmaChan[channel].count = trans_count;
+	if (trigger)
+		runChannel(channel);
+}
+
+void dma_channel_start(unsigned int channel)
+{
+	runChannel(channel);
+}
+
+bool dma_channel_is_busy(unsigned int channel)
+{
+	(void)channel;
+	return SIM_dmaBusy();
+}
+
+void dma_channel_wait_for_finish_blocking(unsigned int channel)
+{
+	(void)channel;
+	SIM_dmaWait();
+}
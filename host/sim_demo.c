@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <string.h>
+#include "gfx.h"
+#include "ili9488.h"
+#include "ili9488_sim.h"
+
+// Draws a small test screen on the simulated panel, writes it to a PPM and
+// prints what it cost on the wire.
+//
+//   ili9488_sim_demo [out.ppm] [--trace trace.txt]
+
+static void printStats(const char *what, struct SIM_Stats s)
+{
+	printf("%-10s %9llu bytes (%llu cmd, %llu pixel) %7llu px  CASET %u PASET %u RAMWR %u  CS %u  fmt %u  %8.3f ms\n",
+		   what, (unsigned long long)s.bytes, (unsigned long long)s.cmdBytes, (unsigned long long)s.pixelBytes,
+		   (unsigned long long)s.pixels, s.caset, s.paset, s.ramwr, s.csSelects, s.setFormat,
+		   s.wireTimeNs / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+	const char *out = "sim_demo.ppm";
+	const char *trace = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+			trace = argv[++i];
+		else
+			out = argv[i];
+	}
+
+	SIM_reset();
+	LCD_initDisplay();
+	printStats("init", SIM_getStats());
+
+	SIM_resetStats();
+	LCD_setRotation(1);
+	GFX_setClearColor((struct Color){0x10, 0x20, 0x40});
+	GFX_clearScreen();
+	printStats("clear", SIM_getStats());
+
+	SIM_resetStats();
+	struct Color white = {0xFF, 0xFF, 0xFF};
+	struct Color red = {0xFF, 0x00, 0x00};
+	struct Color green = {0x00, 0xFF, 0x00};
+	struct Color yellow = {0xFF, 0xFF, 0x00};
+	GFX_drawRect(10, 10, 200, 100, white);
+	GFX_fillRoundedRect(20, 20, 80, 40, 8, red);
+	GFX_fillCircle(160, 60, 30, green);
+	GFX_drawLine(0, 319, 479, 0, yellow);
+	GFX_fillTriangle(300, 40, 460, 60, 380, 140, (struct Color){0x00, 0x80, 0xFF});
+	GFX_setCursor(10, 200);
+	GFX_setTextColor(white);
+	GFX_setTextBack((struct Color){0x10, 0x20, 0x40});
+	GFX_printf(2, "Hello ILI9488 %d", 42);
+	printStats("draw", SIM_getStats());
+
+	if (!SIM_dumpPPM(out))
+	{
+		fprintf(stderr, "cannot write %s\n", out);
+		return 1;
+	}
+	printf("frame %08x written to %s\n", SIM_hashFrame(), out);
+
+	if (trace)
+	{
+		FILE *f = fopen(trace, "w");
+		if (f == NULL)
+		{
+			fprintf(stderr, "cannot write %s\n", trace);
+			return 1;
+		}
+		SIM_writeTrace(f);
+		fclose(f);
+	}
+	return 0;
+}
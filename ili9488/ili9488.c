@@ -1,3 +1,4 @@
+#include <string.h>
 #include "pico/stdlib.h"
 #include "hardware/dma.h"
 #include "ili9488.h"
@@ -19,33 +20,100 @@ uint16_t ili9488_pinTX = PICO_DEFAULT_SPI_TX_PIN;
 uint16_t _width;  ///< Display width as modified by current rotation
 uint16_t _height; ///< Display height as modified by current rotation
 
-uint8_t initcmd[] = {
-	15, //24 commands
-	0xE0, 15, 0x00, 0x03, 0x09, 0x08, 0x16, 0x0A, 0x3F, 0x78, 0x4C, 0x09, 0x0A, 0x08, 0x16, 0x1A, 0x0F,
-	0XE1, 15 ,0x00 ,0x16 ,0x19 ,0x03 ,0x0F ,0x05 ,0x32 ,0x45 ,0x46 ,0x04 ,0x0E ,0x0D ,0x35 ,0x37 ,0x0F,
-	0XC0, 2 , 0x17, 0x15,
-	0xC1, 1, 0x41,
-	0xC5, 3, 0x00, 0x12, 0x80,
-	ILI9488_MADCTL, 1, 0x48,
-	0x3A, 1, 0x77,
-	0xB0, 1, 0x80,
-	0xB1, 1, 0xA0,
-	0xB4, 1, 0x02,
-	0xB6, 3, 0x02, 0x02, 0x3B,
-	0xB7, 1, 0xC6,
-	0xF7, 4, 0xA9, 0x51, 0x2C, 0x82,
-	ILI9488_SLPOUT, 0x80,
-	ILI9488_DISPON, 0x80,
+static uint8_t writeDepth = 0; ///< LCD_beginWrite nesting level
+static bool busOpen = false;   ///< CS asserted and SPI format set for the current transaction
+
+// Address window last sent to the controller, so an unchanged CASET or PASET can be skipped
+static bool windowValid = false;
+static uint16_t windowX0, windowX1, windowY0, windowY1;
+
+// Where the controller writes the next pixel while a RAMWR burst is still open
+static bool ramwrOpen = false;
+static uint16_t nextX, nextY;
+static uint16_t lastX, lastY;
+
+static enum LCD_ColorMode colorMode = LCD_COLOR_18BIT;
+
+#define FILL_PATTERN_PIXELS 32  ///< Pixels of colour LCD_FillRect keeps on the stack
+#define FILL_DMA_MIN_PIXELS 128 ///< Smaller fills aren't worth setting up DMA and the 12-bit format
+
+#define INIT_DELAY 0x80 ///< Set in the length of an initcmd entry when a delay in ms follows its parameters
+
+// The commands LCD_initDisplay sends: their count, then for each one the command,
+// the number of parameters (| INIT_DELAY), the parameters and the delay if any
+static const uint8_t initcmd[] = {
+	17, // commands
+	0xE0, 15, 0x00, 0x03, 0x09, 0x08, 0x16, 0x0A, 0x3F, 0x78, 0x4C, 0x09, 0x0A, 0x08, 0x16, 0x1A, 0x0F, // Positive Gamma Control
+	0xE1, 15, 0x00, 0x16, 0x19, 0x03, 0x0F, 0x05, 0x32, 0x45, 0x46, 0x04, 0x0E, 0x0D, 0x35, 0x37, 0x0F, // Negative Gamma Control
+	0xC0, 2, 0x17, 0x15,			 // Power Control 1
+	0xC1, 1, 0x41,					 // Power Control 2
+	0xC5, 3, 0x00, 0x12, 0x80,		 // VCOM Control
+	ILI9488_MADCTL, 1, 0x48,		 // MX, BGR
+	ILI9488_PIXFMT, 1, 0x66,		 // 18-bit colour for SPI
+	0xB0, 1, 0x00,					 // Interface Mode Control
+	0xB1, 1, 0xA0,					 // Frame Rate Control
+	0xB4, 1, 0x02,					 // Display Inversion Control
+	0xB6, 3, 0x02, 0x02, 0x3B,		 // Display Function Control
+	0xB7, 1, 0xC6,					 // Entry Mode Set
+	0xF7, 4, 0xA9, 0x51, 0x2C, 0x82, // Adjust Control 3
+	ILI9488_NORON, 0,				 // Partial mode and scrolling may be left over from before a warm restart
+	ILI9488_IDMOFF, 0,
+	ILI9488_SLPOUT, INIT_DELAY | 0, 120,
+	ILI9488_DISPON, INIT_DELAY | 0, 25,
 };
 
+#ifdef USE_STATS
+struct LCD_Stats lcd_stats;
+
+void LCD_getStats(struct LCD_Stats *stats)
+{
+	*stats = lcd_stats;
+}
+
+void LCD_resetStats()
+{
+	struct LCD_Stats zero = {0};
+	lcd_stats = zero;
+}
+#endif
+
+void ILI9488_DeSelect();
+
 #ifdef USE_DMA
-uint dma_tx;
+int dma_tx = -1;
 dma_channel_config dma_cfg;
+static bool dmaPending = false; ///< LCD_WriteBitmapAsync transfer not waited for yet
+
 void waitForDMA()
 {
-
+#ifdef USE_STATS
+	uint64_t start = time_us_64();
+#endif
 	dma_channel_wait_for_finish_blocking(dma_tx);
+	// The last frames are still in the SPI FIFO, CS or the format mustn't change under them
+	while (spi_is_busy(ili9488_spi))
+		;
+#ifdef USE_STATS
+	LCD_STAT_ADD(dmaWaitUs, time_us_64() - start);
+#endif
+	dmaPending = false;
+	if (writeDepth == 0 && busOpen)
+	{
+		// LCD_endWrite left CS asserted for the transfer, release it now
+		ILI9488_DeSelect();
+		busOpen = false;
+		ramwrOpen = false;
+	}
 }
+
+// Anything that touches the bus has to let a running bitmap transfer finish first
+static void finishDMA()
+{
+	if (dmaPending)
+		waitForDMA();
+}
+#else
+#define finishDMA() ((void)0)
 #endif
 
 void LCD_setPins(uint16_t dc, uint16_t cs, int16_t rst, uint16_t sck, uint16_t tx)
@@ -65,7 +133,7 @@ void LCD_setSPIperiph(spi_inst_t *s)
 void initSPI()
 {
 	spi_init(ili9488_spi, 1000 * 40000);
-	spi_set_format(ili9488_spi, 16, SPI_CPOL_1, SPI_CPOL_1, SPI_MSB_FIRST);
+	spi_set_format(ili9488_spi, 16, SPI_CPOL_1, SPI_CPHA_1, SPI_MSB_FIRST);
 	gpio_set_function(ili9488_pinSCK, GPIO_FUNC_SPI);
 	gpio_set_function(ili9488_pinTX, GPIO_FUNC_SPI);
 
@@ -85,9 +153,10 @@ void initSPI()
 	}
 
 #ifdef USE_DMA
-	dma_tx = dma_claim_unused_channel(true);
+	if (dma_tx < 0) // Keep the channel when the display is initialized again
+		dma_tx = dma_claim_unused_channel(true);
 	dma_cfg = dma_channel_get_default_config(dma_tx);
-	channel_config_set_transfer_data_size(&dma_cfg, DMA_SIZE_16);
+	channel_config_set_transfer_data_size(&dma_cfg, DMA_SIZE_8);
 	channel_config_set_dreq(&dma_cfg, spi_get_dreq(ili9488_spi, true));
 #endif
 }
@@ -123,126 +192,117 @@ void ILI9488_RegData()
 	gpio_put(ili9488_pinDC, 1);
 }
 
+// Selects the display for the current transaction, the first time only
+void ILI9488_OpenBus()
+{
+	finishDMA();
+	if (!busOpen)
+	{
+		ILI9488_Select();
+		spi_set_format(ili9488_spi, 8, SPI_CPOL_1, SPI_CPHA_1, SPI_MSB_FIRST);
+		busOpen = true;
+	}
+}
+
 void ILI9488_WriteCommand(uint8_t cmd)
 {
+	finishDMA();
 	ILI9488_RegCommand();
-	spi_set_format(ili9488_spi, 8, SPI_CPOL_1, SPI_CPOL_1, SPI_MSB_FIRST);
+	if (!busOpen)
+		spi_set_format(ili9488_spi, 8, SPI_CPOL_1, SPI_CPHA_1, SPI_MSB_FIRST);
 	spi_write_blocking(ili9488_spi, &cmd, sizeof(cmd));
+	LCD_STAT_ADD(bytes, sizeof(cmd));
+	ramwrOpen = false; // Any command ends a memory write
 }
 
 void ILI9488_WriteData(uint8_t *buff, size_t buff_size)
 {
+	finishDMA();
 	ILI9488_RegData();
-	spi_set_format(ili9488_spi, 8, SPI_CPOL_1, SPI_CPOL_1, SPI_MSB_FIRST);
+	if (!busOpen)
+		spi_set_format(ili9488_spi, 8, SPI_CPOL_1, SPI_CPHA_1, SPI_MSB_FIRST);
 	spi_write_blocking(ili9488_spi, buff, buff_size);
+	LCD_STAT_ADD(bytes, buff_size);
 }
 
-void write8data(uint8_t cmd)
+void LCD_beginWrite()
 {
-	ILI9488_RegData();
-	spi_set_format(ili9488_spi, 8, SPI_CPOL_1, SPI_CPOL_1, SPI_MSB_FIRST);
-	spi_write_blocking(ili9488_spi, &cmd, sizeof(cmd));
+	writeDepth++;
+}
+
+void LCD_endWrite()
+{
+	if (writeDepth == 0 || --writeDepth > 0)
+	{
+		return;
+	}
+#ifdef USE_DMA
+	if (dmaPending)
+	{
+		return; // CS is released once the transfer is done
+	}
+#endif
+	if (busOpen)
+	{
+		ILI9488_DeSelect();
+		busOpen = false;
+	}
+	ramwrOpen = false; // The controller isn't guaranteed to continue a write after CS goes high
 }
 
 void ILI9488_SendCommand(uint8_t commandByte, uint8_t *dataBytes,
 						 uint8_t numDataBytes)
 {
-	ILI9488_Select();
+	LCD_beginWrite();
+	ILI9488_OpenBus();
 
 	ILI9488_WriteCommand(commandByte);
-	ILI9488_WriteData(dataBytes, numDataBytes);
-
-	ILI9488_DeSelect();
-}
-
-
-void innt()
-{
-	ILI9488_WriteCommand(0xE0); // Positive Gamma Control
-    write8data(0x00);
-    write8data(0x03);
-    write8data(0x09);
-    write8data(0x08);
-    write8data(0x16);
-    write8data(0x0A);
-    write8data(0x3F);
-    write8data(0x78);
-    write8data(0x4C);
-    write8data(0x09);
-    write8data(0x0A);
-    write8data(0x08);
-    write8data(0x16);
-    write8data(0x1A);
-    write8data(0x0F);
-
-    ILI9488_WriteCommand(0XE1); // Negative Gamma Control
-    write8data(0x00);
-    write8data(0x16);
-    write8data(0x19);
-    write8data(0x03);
-    write8data(0x0F);
-    write8data(0x05);
-    write8data(0x32);
-    write8data(0x45);
-    write8data(0x46);
-    write8data(0x04);
-    write8data(0x0E);
-    write8data(0x0D);
-    write8data(0x35);
-    write8data(0x37);
-    write8data(0x0F);
-
-    ILI9488_WriteCommand(0XC0); // Power Control 1
-    write8data(0x17);
-    write8data(0x15);
-
-    ILI9488_WriteCommand(0xC1); // Power Control 2
-    write8data(0x41);
-
-    ILI9488_WriteCommand(0xC5); // VCOM Control
-    write8data(0x00);
-    write8data(0x12);
-    write8data(0x80);
-
-    ILI9488_WriteCommand(0x36); // Memory Access Control
-    write8data(0x48);          // MX, BGR
-
-    ILI9488_WriteCommand(0x3A); // Pixel Interface Format
-    write8data(0x66);  // 18-bit colour for SPI
-
-    ILI9488_WriteCommand(0xB0); // Interface Mode Control
-    write8data(0x00);
-
-    ILI9488_WriteCommand(0xB1); // Frame Rate Control
-    write8data(0xA0);
-
-    ILI9488_WriteCommand(0xB4); // Display Inversion Control
-    write8data(0x02);
-
-    ILI9488_WriteCommand(0xB6); // Display Function Control
-    write8data(0x02);
-    write8data(0x02);
-    write8data(0x3B);
-
-    ILI9488_WriteCommand(0xB7); // Entry Mode Set
-    write8data(0xC6);
-
-    ILI9488_WriteCommand(0xF7); // Adjust Control 3
-    write8data(0xA9);
-    write8data(0x51);
-    write8data(0x2C);
-    write8data(0x82);
-
-    ILI9488_WriteCommand(0x11);  //Exit Sleep
-	sleep_ms(120);
-
-    ILI9488_WriteCommand(0x29);  //Display on
-	sleep_ms(25);
+	if (numDataBytes > 0)
+		ILI9488_WriteData(dataBytes, numDataBytes);
+
+	LCD_endWrite();
 }
 
-void LCD_initDisplay()
+
+// Sends initcmd in one transaction, the parameters of each command in one
+// burst. The delays are only waited for when the panel was just reset.
+static void sendInitCommands(bool delays)
+{
+	LCD_beginWrite();
+	ILI9488_OpenBus();
+	const uint8_t *p = initcmd;
+	uint8_t count = *p++;
+	while (count--)
+	{
+		uint8_t cmd = *p++;
+		uint8_t n = *p & ~INIT_DELAY;
+		bool delay = *p++ & INIT_DELAY;
+		ILI9488_WriteCommand(cmd);
+		if (n > 0)
+			ILI9488_WriteData((uint8_t *)p, n);
+		p += n;
+		if (delay && delays)
+			sleep_ms(*p);
+		if (delay)
+			p++;
+	}
+	LCD_endWrite();
+}
+
+// Driver state for a panel in the state initcmd leaves it in
+static void resetDriver()
 {
+	finishDMA();
 	initSPI();
+	writeDepth = 0;
+	busOpen = false;
+	windowValid = false;
+	ramwrOpen = false;
+}
+
+void LCD_initDisplay()
+{
+	resetDriver();
 	ILI9488_Select();
 
 	if (ili9488_pinRST < 0)
@@ -252,12 +312,23 @@ void LCD_initDisplay()
 	}
 	else
 		ILI9488_Reset();
-	innt();	
+	sendInitCommands(true);
+	colorMode = LCD_COLOR_18BIT;
 	
 	_width = ILI9488_TFTHEIGHT;
 	_height = ILI9488_TFTWIDTH;
 }
 
+void LCD_initDisplayWarm()
+{
+	resetDriver();
+	sendInitCommands(false);
+	colorMode = LCD_COLOR_18BIT;
+
+	_width = ILI9488_TFTHEIGHT;
+	_height = ILI9488_TFTWIDTH;
+}
+
 void LCD_setRotation(uint8_t m)
 {
 	rotation = m % 4; // can't be higher than 3
@@ -286,56 +357,359 @@ void LCD_setRotation(uint8_t m)
 	}
 
 	ILI9488_SendCommand(ILI9488_MADCTL, &m, 1);
+	windowValid = false;
+}
+
+uint8_t LCD_getRotation()
+{
+	return rotation;
+}
+
+void LCD_setScrollArea(uint16_t top, uint16_t bottom)
+{
+	uint16_t rows = ILI9488_TFTHEIGHT - top - bottom;
+	uint8_t def[6] = {top >> 8, top & 0xFF, rows >> 8, rows & 0xFF, bottom >> 8, bottom & 0xFF};
+	ILI9488_SendCommand(ILI9488_VSCRDEF, def, sizeof(def));
+}
+
+void LCD_setScrollStart(uint16_t row)
+{
+	uint8_t start[2] = {row >> 8, row & 0xFF};
+	ILI9488_SendCommand(ILI9488_VSCRSADD, start, sizeof(start));
+}
+
+void LCD_enterPartialMode(uint16_t start, uint16_t end)
+{
+	uint8_t area[4] = {start >> 8, start & 0xFF, end >> 8, end & 0xFF};
+	ILI9488_SendCommand(ILI9488_PTLAR, area, sizeof(area));
+	ILI9488_SendCommand(ILI9488_PTLON, NULL, 0);
+}
+
+void LCD_enterNormalMode()
+{
+	ILI9488_SendCommand(ILI9488_NORON, NULL, 0);
+}
+
+void LCD_setIdleMode(bool idle)
+{
+	ILI9488_SendCommand(idle ? ILI9488_IDMON : ILI9488_IDMOFF, NULL, 0);
+}
+
+// FRMCTR2: the frame rate in idle mode is the oscillator divided by divider
+// (0-3 for 1, 2, 4 or 8) and by clocksPerLine (16-31) for every line
+void LCD_setIdleFrameRate(uint8_t divider, uint8_t clocksPerLine)
+{
+	uint8_t rate[2] = {divider & 0x03, clocksPerLine & 0x1F};
+	ILI9488_SendCommand(ILI9488_FRMCTR2, rate, sizeof(rate));
 }
 
 void LCD_setAddrWindow(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
 {
-	uint32_t xa = ((uint32_t)x << 16) | (x + w - 1);
-	uint32_t ya = ((uint32_t)y << 16) | (y + h - 1);
+	uint16_t x1 = x + w - 1;
+	uint16_t y1 = y + h - 1;
 
-	xa = __builtin_bswap32(xa);
-	ya = __builtin_bswap32(ya);
+	if (!windowValid || windowX0 != x || windowX1 != x1)
+	{
+		uint32_t xa = __builtin_bswap32(((uint32_t)x << 16) | x1);
+		ILI9488_WriteCommand(ILI9488_CASET);
+		ILI9488_WriteData((uint8_t *)&xa, sizeof(xa));
+	}
 
-	ILI9488_WriteCommand(ILI9488_CASET);
-	ILI9488_WriteData((uint8_t*)&xa, sizeof(xa));
+	if (!windowValid || windowY0 != y || windowY1 != y1)
+	{
+		// row address set
+		uint32_t ya = __builtin_bswap32(((uint32_t)y << 16) | y1);
+		ILI9488_WriteCommand(ILI9488_PASET);
+		ILI9488_WriteData((uint8_t *)&ya, sizeof(ya));
+	}
 
-	// row address set
-	ILI9488_WriteCommand(ILI9488_PASET);
-	ILI9488_WriteData((uint8_t*)&ya, sizeof(ya));
+	windowValid = true;
+	windowX0 = x;
+	windowX1 = x1;
+	windowY0 = y;
+	windowY1 = y1;
 
 	// write to RAM
 	ILI9488_WriteCommand(ILI9488_RAMWR);
+	ramwrOpen = true;
+	nextX = x;
+	nextY = y;
+
+	LCD_STAT_ADD(addrWindows, 1);
+	LCD_STAT_ADD(ramwrBursts, 1);
 }
 
-void LCD_WriteBitmap(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *bitmap)
+static void advanceNext(uint32_t pixels);
+
+static void writePacked3(uint16_t x, uint16_t y, uint16_t w, uint16_t h, const uint8_t *bitmap);
+
+void LCD_WriteBitmapAsync(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *bitmap)
 {
-	ILI9488_Select();
-	LCD_setAddrWindow(x, y, w, h); // Clipped area
-	ILI9488_RegData();
-	spi_set_format(ili9488_spi, 8, SPI_CPOL_1, SPI_CPOL_1, SPI_MSB_FIRST);
+	if (colorMode == LCD_COLOR_3BIT)
+	{
+		writePacked3(x, y, w, h, bitmap);
+		return;
+	}
+	LCD_beginWrite();
+	ILI9488_OpenBus();
+	// Bitmaps stacked below each other in the same columns, like bands of a
+	// frame, go out as one memory write
+	if (!(ramwrOpen && x == nextX && y == nextY && x == windowX0 && x + w - 1 == windowX1 && y + h - 1 <= windowY1))
+	{
+		LCD_setAddrWindow(x, y, w, y + h < _height ? _height - y : h);
+		ILI9488_RegData();
+	}
 #ifdef USE_DMA
 	dma_channel_configure(dma_tx, &dma_cfg,
 						  &spi_get_hw(ili9488_spi)->dr, // write address
 						  bitmap,						// read address
 						  w * h *3,						// element count (each element is of size transfer_data_size)
 						  true);						// start asap
-	waitForDMA();
+	dmaPending = true;
 #else
 
 	spi_write_blocking(ili9488_spi, bitmap, w * h * 3);
 #endif
+	LCD_STAT_ADD(bytes, w * h * 3);
+	LCD_STAT_ADD(pixelsBitmap, w * h);
+	advanceNext(w * h);
 
-	ILI9488_DeSelect();
+	LCD_endWrite();
 }
 
-void LCD_WritePixel(int x, int y, struct Color col)
+void LCD_waitForWrite()
 {
-	ILI9488_Select();
-	LCD_setAddrWindow(x, y, 1, 1); // Clipped area
+	finishDMA();
+}
+
+void LCD_setColorMode(enum LCD_ColorMode mode)
+{
+	uint8_t colmod = mode == LCD_COLOR_3BIT ? 0x11 : 0x66;
+	ILI9488_SendCommand(ILI9488_PIXFMT, &colmod, 1);
+	colorMode = mode;
+}
+
+enum LCD_ColorMode LCD_getColorMode()
+{
+	return colorMode;
+}
+
+// In 3-bit mode every write gets a window of exactly its size. When the pixel
+// count is odd, the second half of the last byte wraps around to the first
+// pixel of the window, so it has to repeat that pixel. These bursts aren't
+// continued, ramwrOpen is cleared after each.
+static void openPackedWindow(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+	LCD_setAddrWindow(x, y, w, h);
 	ILI9488_RegData();
-	spi_set_format(ili9488_spi, 8, SPI_CPOL_1, SPI_CPOL_1, SPI_MSB_FIRST);
-	spi_write_blocking(ili9488_spi, &(col.r), 1);
-	spi_write_blocking(ili9488_spi, &(col.g), 1);
-	spi_write_blocking(ili9488_spi, &(col.b), 1);
-	ILI9488_DeSelect();
+}
+
+// Converts RGB666 pixels to 3-bit on the way out, a chunk at a time
+static void writePacked3(uint16_t x, uint16_t y, uint16_t w, uint16_t h, const uint8_t *bitmap)
+{
+	uint32_t pixels = (uint32_t)w * h;
+	if (pixels == 0)
+		return;
+	LCD_beginWrite();
+	ILI9488_OpenBus();
+	openPackedWindow(x, y, w, h);
+	const uint8_t first = LCD_COLOR3(((struct Color){bitmap[0], bitmap[1], bitmap[2]}));
+	uint8_t chunk[FILL_PATTERN_PIXELS * 3];
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < pixels; i += 2)
+	{
+		const uint8_t *p = &bitmap[i * 3];
+		uint8_t hi = LCD_COLOR3(((struct Color){p[0], p[1], p[2]}));
+		uint8_t lo = i + 1 < pixels ? LCD_COLOR3(((struct Color){p[3], p[4], p[5]})) : first;
+		chunk[n++] = hi << 3 | lo;
+		if (n == sizeof(chunk))
+		{
+			spi_write_blocking(ili9488_spi, chunk, n);
+			n = 0;
+		}
+	}
+	spi_write_blocking(ili9488_spi, chunk, n);
+	LCD_STAT_ADD(bytes, (pixels + 1) / 2);
+	LCD_STAT_ADD(pixelsBitmap, (pixels + 1) / 2 * 2); // Both halves of every byte
+	ramwrOpen = false;
+	LCD_endWrite();
+}
+
+void LCD_WritePackedAsync(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *packed)
+{
+	uint32_t bytes = ((uint32_t)w * h + 1) / 2;
+	if (bytes == 0)
+		return;
+	LCD_beginWrite();
+	ILI9488_OpenBus();
+	openPackedWindow(x, y, w, h);
+#ifdef USE_DMA
+	dma_channel_configure(dma_tx, &dma_cfg, &spi_get_hw(ili9488_spi)->dr, packed, bytes, true);
+	dmaPending = true;
+#else
+	spi_write_blocking(ili9488_spi, packed, bytes);
+#endif
+	LCD_STAT_ADD(bytes, bytes);
+	LCD_STAT_ADD(pixelsBitmap, bytes * 2);
+	ramwrOpen = false;
+	LCD_endWrite();
+}
+
+void LCD_WritePacked(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *packed)
+{
+	LCD_WritePackedAsync(x, y, w, h, packed);
+	LCD_waitForWrite();
+}
+
+void LCD_WriteBitmap(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *bitmap)
+{
+	LCD_WriteBitmapAsync(x, y, w, h, bitmap);
+	LCD_waitForWrite();
+}
+
+void LCD_WritePixel(int x, int y, struct Color col);
+
+// Moves the expected write position the way the controller's address counter moves
+static void advanceNext(uint32_t pixels)
+{
+	uint32_t windowW = windowX1 - windowX0 + 1;
+	uint32_t windowH = windowY1 - windowY0 + 1;
+	uint32_t col = nextX - windowX0 + pixels;
+	nextX = windowX0 + col % windowW;
+	nextY = windowY0 + (nextY - windowY0 + col / windowW) % windowH;
+}
+
+void LCD_FillRect(uint16_t x, uint16_t y, uint16_t w, uint16_t h, struct Color col)
+{
+	uint32_t pixels = (uint32_t)w * h;
+	if (pixels == 0)
+	{
+		return;
+	}
+	if (pixels == 1)
+	{
+		LCD_WritePixel(x, y, col);
+		return;
+	}
+
+	LCD_beginWrite();
+	ILI9488_OpenBus();
+	if (colorMode == LCD_COLOR_3BIT)
+	{
+		// Every half byte holds the colour, so an odd count just repeats the first pixel
+		uint8_t pattern[FILL_PATTERN_PIXELS * 3];
+		memset(pattern, LCD_COLOR3(col) * 9, sizeof(pattern));
+		openPackedWindow(x, y, w, h);
+		uint32_t bytes = (pixels + 1) / 2;
+		for (uint32_t left = bytes; left > 0;)
+		{
+			uint32_t n = left < sizeof(pattern) ? left : sizeof(pattern);
+			spi_write_blocking(ili9488_spi, pattern, n);
+			left -= n;
+		}
+		LCD_STAT_ADD(bytes, bytes);
+		LCD_STAT_ADD(pixelsFill, bytes * 2);
+		ramwrOpen = false;
+		LCD_endWrite();
+		return;
+	}
+	bool continues = ramwrOpen && x == nextX && y == nextY &&
+					 ((h == 1 && x + w - 1 <= windowX1) ||
+					  (x == windowX0 && x + w - 1 == windowX1 && y + h - 1 <= windowY1));
+	if (!continues)
+	{
+		// Like LCD_WritePixel, open the window down to the bottom of the screen, and
+		// to its right edge for a single row, so that a following span can continue it
+		LCD_setAddrWindow(x, y, h == 1 ? _width - x : w, _height - y);
+		ILI9488_RegData();
+	}
+#ifdef USE_DMA
+	if (pixels >= FILL_DMA_MIN_PIXELS)
+	{
+		// A pixel is exactly two 12-bit SPI frames, so a 4-byte DMA read ring
+		// repeats any colour for the whole area without a buffer
+		static uint16_t fillFrames[2] __attribute__((aligned(4)));
+		fillFrames[0] = ((uint16_t)col.r << 4) | (col.g >> 4);
+		fillFrames[1] = ((uint16_t)(col.g & 0x0F) << 8) | col.b;
+
+		dma_channel_config cfg = dma_cfg;
+		channel_config_set_transfer_data_size(&cfg, DMA_SIZE_16);
+		channel_config_set_ring(&cfg, false, 2);
+		spi_set_format(ili9488_spi, 12, SPI_CPOL_1, SPI_CPHA_1, SPI_MSB_FIRST);
+		dma_channel_configure(dma_tx, &cfg,
+							  &spi_get_hw(ili9488_spi)->dr, // write address
+							  fillFrames,					// read address, wraps every 4 bytes
+							  pixels * 2,					// two frames per pixel
+							  true);						// start asap
+		waitForDMA();
+		spi_set_format(ili9488_spi, 8, SPI_CPOL_1, SPI_CPHA_1, SPI_MSB_FIRST);
+	}
+	else
+#endif
+	{
+		// A short run of the colour is sent over and over
+		uint8_t pattern[FILL_PATTERN_PIXELS * 3];
+		uint32_t patternPixels = pixels < FILL_PATTERN_PIXELS ? pixels : FILL_PATTERN_PIXELS;
+		for (uint32_t i = 0; i < patternPixels; i++)
+		{
+			pattern[i * 3] = col.r;
+			pattern[i * 3 + 1] = col.g;
+			pattern[i * 3 + 2] = col.b;
+		}
+		for (uint32_t left = pixels; left > 0;)
+		{
+			uint32_t n = left < patternPixels ? left : patternPixels;
+			spi_write_blocking(ili9488_spi, pattern, n * 3);
+			left -= n;
+		}
+	}
+	LCD_STAT_ADD(bytes, pixels * 3);
+	LCD_STAT_ADD(pixelsFill, pixels);
+	advanceNext(pixels);
+	lastX = x + w - 1;
+	lastY = y + h - 1;
+	LCD_endWrite();
+}
+
+void LCD_WritePixel(int x, int y, struct Color col)
+{
+	if (x < 0 || y < 0 || x >= _width || y >= _height)
+	{
+		return;
+	}
+
+	LCD_beginWrite();
+	ILI9488_OpenBus();
+	if (colorMode == LCD_COLOR_3BIT)
+	{
+		// Both halves of the byte land on the one pixel of the window
+		uint8_t packed = LCD_COLOR3(col) * 9;
+		openPackedWindow(x, y, 1, 1);
+		spi_write_blocking(ili9488_spi, &packed, 1);
+		LCD_STAT_ADD(bytes, 1);
+		LCD_STAT_ADD(pixelsWritePixel, 2);
+		ramwrOpen = false;
+		LCD_endWrite();
+		return;
+	}
+	if (!ramwrOpen || x != nextX || y != nextY)
+	{
+		// Open the window towards the screen edge so that following adjacent
+		// pixels continue this burst. Go down if the last pixel was just above.
+		if (ramwrOpen && x == lastX && y == lastY + 1)
+			LCD_setAddrWindow(x, y, 1, _height - y);
+		else
+			LCD_setAddrWindow(x, y, _width - x, _height - y);
+		ILI9488_RegData();
+	}
+
+	uint8_t rgb[3] = {col.r, col.g, col.b};
+	spi_write_blocking(ili9488_spi, rgb, sizeof(rgb));
+	LCD_STAT_ADD(bytes, 3);
+	LCD_STAT_ADD(pixelsWritePixel, 1);
+
+	lastX = x;
+	lastY = y;
+	advanceNext(1);
+	LCD_endWrite();
 }
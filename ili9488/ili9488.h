@@ -6,6 +6,9 @@
 // Use DMA?
 //#define USE_DMA 1
 
+// Count bus traffic for LCD_getStats()?
+//#define USE_STATS 1
+
 #define MADCTL_MY 0x80  ///< Bottom to top
 #define MADCTL_MX 0x40  ///< Right to left
 #define MADCTL_MV 0x20  ///< Reverse Mode
@@ -49,6 +52,8 @@
 #define ILI9488_VSCRDEF 0x33  ///< Vertical Scrolling Definition
 #define ILI9488_MADCTL 0x36   ///< Memory Access Control
 #define ILI9488_VSCRSADD 0x37 ///< Vertical Scrolling Start Address
+#define ILI9488_IDMOFF 0x38   ///< Idle Mode OFF
+#define ILI9488_IDMON 0x39    ///< Idle Mode ON
 #define ILI9488_PIXFMT 0x3A   ///< COLMOD: Pixel Format Set
 
 #define ILI9488_FRMCTR1                                                        \
@@ -96,17 +101,79 @@ struct Color
   uint8_t b;
 };
 
+/// Pixel format on the wire, see LCD_setColorMode
+enum LCD_ColorMode
+{
+	LCD_COLOR_18BIT, ///< 3 bytes per pixel, RGB666 (COLMOD 0x66)
+	LCD_COLOR_3BIT,	 ///< 2 pixels per byte, one bit per channel (COLMOD 0x11)
+};
+
+/// A colour in 3-bit mode: bit 2 red, bit 1 green, bit 0 blue, each channel on from 0x80
+#define LCD_COLOR3(col) ((((col).r >> 7) << 2) | (((col).g >> 7) << 1) | ((col).b >> 7))
+
+/// Counters kept by the driver when USE_STATS is defined
+struct LCD_Stats
+{
+	uint64_t bytes;			  ///< Bytes sent to the display, commands included
+	uint32_t addrWindows;	  ///< LCD_setAddrWindow calls
+	uint32_t ramwrBursts;	  ///< RAMWR commands, each one starts a burst of pixel data
+	uint32_t pixelsWritePixel; ///< Pixels written through LCD_WritePixel
+	uint32_t pixelsBitmap;	  ///< Pixels written through LCD_WriteBitmap
+	uint32_t pixelsFill;	  ///< Pixels written through LCD_FillRect
+	uint64_t dmaWaitUs;		  ///< Time spent blocked in waitForDMA
+	uint32_t framebufMallocs; ///< Framebuffers allocated by GFX_createFramebuf
+	uint32_t framebufFrees;	  ///< Framebuffers released by GFX_destroyFramebuf
+};
+
+#ifdef USE_STATS
+extern struct LCD_Stats lcd_stats;
+#define LCD_STAT_ADD(field, n) (lcd_stats.field += (n))
+void LCD_getStats(struct LCD_Stats *stats);
+void LCD_resetStats();
+#else
+#define LCD_STAT_ADD(field, n) ((void)0)
+#endif
+
 extern uint16_t _width;
 extern uint16_t _height;
 
 void LCD_setPins(uint16_t dc, uint16_t cs, int16_t rst, uint16_t sck, uint16_t tx);
 void LCD_setSPIperiph(spi_inst_t *s);
 void LCD_initDisplay();
+// For a panel that kept its power and configuration, e.g. after a watchdog reset of the MCU:
+// no reset and no waits, the registers are sent again and the picture stays until redrawn
+void LCD_initDisplayWarm();
 
 void LCD_setRotation(uint8_t m);
+uint8_t LCD_getRotation();
+
+// Vertical scrolling, in memory rows (top to bottom in rotation 0). Rows top..479-bottom
+// scroll, LCD_setScrollStart picks the row shown first in that area.
+void LCD_setScrollArea(uint16_t top, uint16_t bottom);
+void LCD_setScrollStart(uint16_t row);
+
+// Partial mode only shows memory rows start..end (counted as LCD_setScrollArea does), normal mode
+// shows them all again. Either ends vertical scrolling.
+void LCD_enterPartialMode(uint16_t start, uint16_t end);
+void LCD_enterNormalMode();
+// Idle mode shows 8 colours, the top bit of each channel, at the frame rate set by LCD_setIdleFrameRate
+void LCD_setIdleMode(bool idle);
+void LCD_setIdleFrameRate(uint8_t divider, uint8_t clocksPerLine);
+
+void LCD_beginWrite();
+void LCD_endWrite();
+void LCD_setAddrWindow(uint16_t x, uint16_t y, uint16_t w, uint16_t h);
 
 void LCD_WritePixel(int x, int y, struct Color col);
 void LCD_WriteBitmap(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *bitmap);
+void LCD_WriteBitmapAsync(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *bitmap);
+void LCD_waitForWrite();
+void LCD_FillRect(uint16_t x, uint16_t y, uint16_t w, uint16_t h, struct Color col);
+
+void LCD_setColorMode(enum LCD_ColorMode mode);
+enum LCD_ColorMode LCD_getColorMode();
+void LCD_WritePackedAsync(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *packed);
+void LCD_WritePacked(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *packed);
 
 #ifdef __cplusplus
 }